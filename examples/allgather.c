@@ -0,0 +1,62 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "test.h"
+#include "../mimpi.h"
+#include "mimpi_err.h"
+
+static void check_allgather(int block, int world_size, int rank) {
+    uint8_t* data = malloc(block);
+    uint8_t* recv_data = malloc(block * world_size);
+    for (int i = 0; i < block; ++i) {
+        data[i] = rank + i;
+    }
+    ASSERT_MIMPI_OK(MIMPI_Allgather(data, recv_data, block));
+    for (int r = 0; r < world_size; ++r) {
+        for (int i = 0; i < block; ++i) {
+            test_assert(recv_data[r * block + i] == (uint8_t)(r + i));
+        }
+    }
+    free(data);
+    free(recv_data);
+}
+
+static void check_allgatherv(int scale, int world_size, int rank) {
+    // Process i sends scale * (i % 3 + 1) bytes, placed in reverse rank order.
+    int counts[world_size];
+    int displs[world_size];
+    int total = 0;
+    for (int i = world_size - 1; i >= 0; --i) {
+        counts[i] = scale * (i % 3 + 1);
+        displs[i] = total;
+        total += counts[i];
+    }
+    uint8_t* data = malloc(counts[rank]);
+    uint8_t* recv_data = malloc(total);
+    for (int i = 0; i < counts[rank]; ++i) {
+        data[i] = 7 * rank + i;
+    }
+    ASSERT_MIMPI_OK(MIMPI_Allgatherv(data, recv_data, counts, displs));
+    for (int r = 0; r < world_size; ++r) {
+        for (int i = 0; i < counts[r]; ++i) {
+            test_assert(recv_data[displs[r] + i] == (uint8_t)(7 * r + i));
+        }
+    }
+    free(data);
+    free(recv_data);
+}
+
+int main(int argc, char **argv) {
+    MIMPI_Init(false);
+    int world_size = MIMPI_World_size();
+    int rank = MIMPI_World_rank();
+    check_allgather(1, world_size, rank);
+    check_allgather(3000, world_size, rank);
+    check_allgatherv(5, world_size, rank);
+    check_allgatherv(700, world_size, rank);
+    MIMPI_Finalize();
+    return test_success();
+}
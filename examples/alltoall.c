@@ -0,0 +1,74 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "test.h"
+#include "../mimpi.h"
+#include "mimpi_err.h"
+
+static uint8_t value(int from, int to, int i) {
+    return 31 * from + 7 * to + i;
+}
+
+static void check_alltoall(int block, int world_size, int rank) {
+    uint8_t* data = malloc(block * world_size);
+    uint8_t* recv_data = malloc(block * world_size);
+    for (int to = 0; to < world_size; ++to) {
+        for (int i = 0; i < block; ++i) {
+            data[to * block + i] = value(rank, to, i);
+        }
+    }
+    ASSERT_MIMPI_OK(MIMPI_Alltoall(data, recv_data, block));
+    for (int from = 0; from < world_size; ++from) {
+        for (int i = 0; i < block; ++i) {
+            test_assert(recv_data[from * block + i] == value(from, rank, i));
+        }
+    }
+    free(data);
+    free(recv_data);
+}
+
+// Process i sends (i + j) % 4 * scale bytes to process j.
+static void check_alltoallv(int scale, int world_size, int rank) {
+    int send_counts[world_size], send_displs[world_size];
+    int recv_counts[world_size], recv_displs[world_size];
+    int send_total = 0, recv_total = 0;
+    for (int j = 0; j < world_size; ++j) {
+        send_counts[j] = (rank + j) % 4 * scale;
+        send_displs[j] = send_total;
+        send_total += send_counts[j];
+        recv_counts[j] = (j + rank) % 4 * scale;
+        recv_displs[j] = recv_total;
+        recv_total += recv_counts[j];
+    }
+    uint8_t* data = malloc(send_total);
+    uint8_t* recv_data = malloc(recv_total);
+    for (int to = 0; to < world_size; ++to) {
+        for (int i = 0; i < send_counts[to]; ++i) {
+            data[send_displs[to] + i] = value(rank, to, i);
+        }
+    }
+    ASSERT_MIMPI_OK(MIMPI_Alltoallv(data, send_counts, send_displs, recv_data, recv_counts, recv_displs));
+    for (int from = 0; from < world_size; ++from) {
+        for (int i = 0; i < recv_counts[from]; ++i) {
+            test_assert(recv_data[recv_displs[from] + i] == value(from, rank, i));
+        }
+    }
+    free(data);
+    free(recv_data);
+}
+
+int main(int argc, char **argv) {
+    MIMPI_Init(false);
+    int world_size = MIMPI_World_size();
+    int rank = MIMPI_World_rank();
+    check_alltoall(1, world_size, rank);
+    check_alltoall(5, world_size, rank);
+    check_alltoall(1000, world_size, rank);
+    check_alltoallv(3, world_size, rank);
+    check_alltoallv(400, world_size, rank);
+    MIMPI_Finalize();
+    return test_success();
+}
@@ -0,0 +1,82 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "test.h"
+#include "../mimpi.h"
+#include "mimpi_err.h"
+
+#define COLUMNS 3
+
+int main(int argc, char **argv) {
+    MIMPI_Init(false);
+    int rank = MIMPI_World_rank();
+    int size = MIMPI_World_size();
+    test_assert(MIMPI_Comm_size(MIMPI_COMM_WORLD) == size);
+    test_assert(MIMPI_Comm_rank(MIMPI_COMM_WORLD) == rank);
+
+    MIMPI_Comm row, column;
+    ASSERT_MIMPI_OK(MIMPI_Comm_split(MIMPI_COMM_WORLD, rank / COLUMNS, rank, &row));
+    // Columns are ranked backwards.
+    ASSERT_MIMPI_OK(MIMPI_Comm_split(MIMPI_COMM_WORLD, rank % COLUMNS, -rank, &column));
+    int row_size = size / COLUMNS == rank / COLUMNS ? size % COLUMNS : COLUMNS;
+    int column_size = (size - rank % COLUMNS + COLUMNS - 1) / COLUMNS;
+    test_assert(MIMPI_Comm_size(row) == row_size);
+    test_assert(MIMPI_Comm_rank(row) == rank % COLUMNS);
+    test_assert(MIMPI_Comm_size(column) == column_size);
+    test_assert(MIMPI_Comm_rank(column) == column_size - 1 - rank / COLUMNS);
+
+    // Row reductions run alongside each other.
+    uint8_t value = rank;
+    uint8_t sum = 0;
+    ASSERT_MIMPI_OK(MIMPI_Comm_reduce(&value, &sum, 1, MIMPI_SUM, row_size - 1, row));
+    if (MIMPI_Comm_rank(row) == row_size - 1) {
+        int first = rank / COLUMNS * COLUMNS;
+        test_assert(sum == (uint8_t)(row_size * first + row_size * (row_size - 1) / 2));
+    }
+
+    uint8_t column_value = rank;
+    ASSERT_MIMPI_OK(MIMPI_Comm_bcast(&column_value, 1, 0, column));
+    test_assert(column_value == rank % COLUMNS + (column_size - 1) * COLUMNS);
+
+    ASSERT_MIMPI_OK(MIMPI_Comm_barrier(column));
+
+    // The same tag in different communicators doesn't match.
+    if (row_size > 1) {
+        int next = (MIMPI_Comm_rank(row) + 1) % row_size;
+        int prev = (MIMPI_Comm_rank(row) + row_size - 1) % row_size;
+        MIMPI_Comm row_copy;
+        ASSERT_MIMPI_OK(MIMPI_Comm_dup(row, &row_copy));
+        test_assert(MIMPI_Comm_rank(row_copy) == MIMPI_Comm_rank(row));
+        int first = 1, second = 2;
+        ASSERT_MIMPI_OK(MIMPI_Comm_send(&first, sizeof(int), next, 1, row));
+        ASSERT_MIMPI_OK(MIMPI_Comm_send(&second, sizeof(int), next, 1, row_copy));
+        int received;
+        ASSERT_MIMPI_OK(MIMPI_Comm_recv(&received, sizeof(int), prev, 1, row_copy));
+        test_assert(received == 2);
+        ASSERT_MIMPI_OK(MIMPI_Comm_recv(&received, sizeof(int), prev, MIMPI_ANY_TAG, row));
+        test_assert(received == 1);
+        test_assert(MIMPI_Comm_send(&first, sizeof(int), row_size, 1, row) == MIMPI_ERROR_NO_SUCH_RANK);
+        MIMPI_Comm_free(&row_copy);
+        test_assert(row_copy == MIMPI_COMM_NULL);
+    }
+
+    MIMPI_Comm even;
+    ASSERT_MIMPI_OK(MIMPI_Comm_split(MIMPI_COMM_WORLD, rank % 2 == 0 ? 0 : MIMPI_UNDEFINED, 0, &even));
+    if (rank % 2 == 0) {
+        test_assert(MIMPI_Comm_size(even) == (size + 1) / 2);
+        test_assert(MIMPI_Comm_rank(even) == rank / 2);
+        ASSERT_MIMPI_OK(MIMPI_Comm_barrier(even));
+    } else {
+        test_assert(even == MIMPI_COMM_NULL);
+    }
+
+    ASSERT_MIMPI_OK(MIMPI_Barrier());
+    MIMPI_Comm_free(&even);
+    MIMPI_Comm_free(&row);
+    MIMPI_Comm_free(&column);
+    MIMPI_Finalize();
+    return test_success();
+}
@@ -0,0 +1,53 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "../mimpi.h"
+#include "mimpi_err.h"
+
+int main(int argc, char **argv) {
+    MIMPI_Init(true);
+    int rank = MIMPI_World_rank();
+    int size = MIMPI_World_size();
+    int next = (rank + 1) % size;
+    int previous = (rank + size - 1) % size;
+    char token = 0;
+
+    // Everyone waits for the next one around the ring.
+    ASSERT_MIMPI_RETCODE(MIMPI_Recv(&token, 1, next, 1), MIMPI_ERROR_DEADLOCK_DETECTED);
+
+    // The same ring, but the token is coming: process 0 starts it late, while the others wait in a chain.
+    if (rank == 0) {
+        usleep(100000);
+        ASSERT_MIMPI_OK(MIMPI_Send(&token, 1, previous, 2));
+        ASSERT_MIMPI_OK(MIMPI_Recv(&token, 1, next, 2));
+    } else {
+        ASSERT_MIMPI_OK(MIMPI_Recv(&token, 1, next, 2));
+        ASSERT_MIMPI_OK(MIMPI_Send(&token, 1, previous, 2));
+    }
+
+    // A receive from a process that waits in a barrier for the receiver.
+    if (rank == 0) {
+        ASSERT_MIMPI_RETCODE(MIMPI_Recv(&token, 1, next, 3), MIMPI_ERROR_DEADLOCK_DETECTED);
+    }
+    ASSERT_MIMPI_OK(MIMPI_Barrier());
+
+    // Process 1 has started the barrier that process 0 waits in, so its receive isn't a deadlock,
+    // although the others come late.
+    if (rank == 0) {
+        ASSERT_MIMPI_OK(MIMPI_Barrier());
+        ASSERT_MIMPI_OK(MIMPI_Send(&token, 1, 1, 4));
+    } else if (rank == 1) {
+        MIMPI_Request request;
+        ASSERT_MIMPI_OK(MIMPI_Ibarrier(&request));
+        ASSERT_MIMPI_OK(MIMPI_Recv(&token, 1, 0, 4));
+        ASSERT_MIMPI_OK(MIMPI_Wait(&request));
+    } else {
+        usleep(300000);
+        ASSERT_MIMPI_OK(MIMPI_Barrier());
+    }
+
+    MIMPI_Finalize();
+    return test_success();
+}
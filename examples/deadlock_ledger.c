@@ -0,0 +1,64 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "../mimpi.h"
+#include "mimpi_err.h"
+
+// Well over the entries the ledger of sent messages keeps per peer, so that many of them collide.
+#define MESSAGES 300
+#define WAITED (MESSAGES / 2)
+#define MAX_COUNT 512
+#define ACK_TAG (MESSAGES + 1)
+
+static int message_count(int i) {
+    return 1 + i * 37 % MAX_COUNT;
+}
+
+int main(int argc, char **argv) {
+    MIMPI_Init(true);
+    int const rank = MIMPI_World_rank();
+    // Silently assumes the number of processes is a multiple of 3
+    int const first = rank / 3 * 3;
+    int const sender = first;
+    int const receiver = first + 1;
+    int const relay = first + 2;
+    static uint8_t data[MAX_COUNT];
+
+    // Every message has its own count and tag. The receiver first waits for one in the middle, which the later
+    // ones have likely pushed out of the sender's ledger, and with reads slowed down (CHANNELS_READ_DELAY) is still
+    // on the way when the receiver starts waiting, after the sender has started to wait for the relay, which waits
+    // for the receiver. The receiver's probes go around that chain while the message is on the way, and the sender
+    // has to tell them from a deadlock even when its ledger has forgotten the message.
+    if (rank == sender) {
+        for (int i = 0; i < MESSAGES; ++i) {
+            data[0] = i % 256;
+            ASSERT_MIMPI_OK(MIMPI_Send(data, message_count(i), receiver, i + 1));
+        }
+        ASSERT_MIMPI_OK(MIMPI_Recv(data, 1, relay, ACK_TAG));
+    } else if (rank == receiver) {
+        usleep(20000);
+        ASSERT_MIMPI_OK(MIMPI_Recv(data, message_count(WAITED), sender, WAITED + 1));
+        assert(data[0] == WAITED % 256);
+        ASSERT_MIMPI_OK(MIMPI_Send(data, 1, relay, ACK_TAG));
+        for (int i = 0; i < MESSAGES; ++i) {
+            if (i != WAITED) {
+                ASSERT_MIMPI_OK(MIMPI_Recv(data, message_count(i), sender, i + 1));
+                assert(data[0] == i % 256);
+            }
+        }
+    } else {
+        ASSERT_MIMPI_OK(MIMPI_Recv(data, 1, receiver, ACK_TAG));
+        ASSERT_MIMPI_OK(MIMPI_Send(data, 1, sender, ACK_TAG));
+    }
+
+    // Once they have all arrived, what the ledger forgot doesn't matter, and a real deadlock is found.
+    if (rank != relay) {
+        ASSERT_MIMPI_RETCODE(MIMPI_Recv(data, 1, rank == sender ? receiver : sender, ACK_TAG), MIMPI_ERROR_DEADLOCK_DETECTED);
+    }
+
+    MIMPI_Finalize();
+    return test_success();
+}
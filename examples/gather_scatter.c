@@ -0,0 +1,73 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "test.h"
+#include "../mimpi.h"
+#include "mimpi_err.h"
+
+int main(int argc, char **argv) {
+    int root = atoi(argv[1]);
+    MIMPI_Init(false);
+    int world_size = MIMPI_World_size();
+    int rank = MIMPI_World_rank();
+    {
+        uint8_t data[2] = {rank, 2 * rank};
+        uint8_t recv_data[2 * world_size];
+        ASSERT_MIMPI_OK(MIMPI_Gather(data, recv_data, 2, root));
+        if (rank == root) {
+            for (int i = 0; i < world_size; ++i) {
+                test_assert(recv_data[2 * i] == i);
+                test_assert(recv_data[2 * i + 1] == 2 * i);
+            }
+        }
+    }
+    {
+        // Process i sends i + 1 bytes.
+        int counts[world_size];
+        int displs[world_size];
+        int total = 0;
+        for (int i = 0; i < world_size; ++i) {
+            counts[i] = i + 1;
+            displs[i] = total;
+            total += counts[i];
+        }
+        uint8_t data[rank + 1];
+        for (int i = 0; i <= rank; ++i) {
+            data[i] = rank;
+        }
+        uint8_t recv_data[total];
+        ASSERT_MIMPI_OK(MIMPI_Gatherv(data, rank + 1, recv_data, counts, displs, root));
+        if (rank == root) {
+            for (int i = 0; i < world_size; ++i) {
+                for (int j = 0; j < counts[i]; ++j) {
+                    test_assert(recv_data[displs[i] + j] == i);
+                }
+            }
+        }
+
+        uint8_t scattered[rank + 1];
+        for (int i = 0; i < total; ++i) {
+            recv_data[i] = rank == root ? 3 * i : 0;
+        }
+        ASSERT_MIMPI_OK(MIMPI_Scatterv(recv_data, counts, displs, scattered, rank + 1, root));
+        for (int j = 0; j <= rank; ++j) {
+            test_assert(scattered[j] == (uint8_t)(3 * (displs[rank] + j)));
+        }
+    }
+    {
+        uint8_t data[3 * world_size];
+        for (int i = 0; i < 3 * world_size; ++i) {
+            data[i] = rank == root ? i : 0;
+        }
+        uint8_t recv_data[3];
+        ASSERT_MIMPI_OK(MIMPI_Scatter(data, recv_data, 3, root));
+        for (int j = 0; j < 3; ++j) {
+            test_assert(recv_data[j] == 3 * rank + j);
+        }
+    }
+    MIMPI_Finalize();
+    return test_success();
+}
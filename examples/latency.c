@@ -0,0 +1,78 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "../mimpi.h"
+#include "mimpi_err.h"
+
+#define ROUNDS 100
+
+static long long percentile(MIMPI_Latency kind, double p, long long *calls) {
+    long long ns;
+    ASSERT_MIMPI_OK(MIMPI_Get_latency(kind, p, &ns, calls));
+    return ns;
+}
+
+int main(int argc, char **argv) {
+    MIMPI_Init(false);
+    int rank = MIMPI_World_rank();
+    uint8_t data[100] = {0};
+    uint8_t sum[100];
+    long long calls;
+
+    assert(percentile(MIMPI_LATENCY_SEND, 50, &calls) == 0);
+    assert(calls == 0);
+    long long ns;
+    ASSERT_MIMPI_RETCODE(MIMPI_Get_latency(MIMPI_LATENCY_KINDS, 50, &ns, NULL), MIMPI_ERROR_INVALID_ARGUMENT);
+    ASSERT_MIMPI_RETCODE(MIMPI_Get_latency(-1, 50, &ns, NULL), MIMPI_ERROR_INVALID_ARGUMENT);
+    ASSERT_MIMPI_RETCODE(MIMPI_Get_latency(MIMPI_LATENCY_SEND, -0.5, &ns, NULL), MIMPI_ERROR_INVALID_ARGUMENT);
+    ASSERT_MIMPI_RETCODE(MIMPI_Get_latency(MIMPI_LATENCY_SEND, 100.5, &ns, NULL), MIMPI_ERROR_INVALID_ARGUMENT);
+
+    // Process 1 sends the last message 50 ms after process 0 asks for it, so only that receive takes that long to match.
+    if (rank == 1) {
+        for (int i = 0; i < ROUNDS; ++i) {
+            if (i == ROUNDS - 1) {
+                ASSERT_MIMPI_OK(MIMPI_Recv(data, 1, 0, 2));
+                usleep(50000);
+            }
+            ASSERT_MIMPI_OK(MIMPI_Send(data, 100, 0, 1));
+        }
+        percentile(MIMPI_LATENCY_SEND, 100, &calls);
+        assert(calls == ROUNDS);
+    }
+    if (rank == 0) {
+        for (int i = 0; i < ROUNDS; ++i) {
+            if (i == ROUNDS - 1) {
+                ASSERT_MIMPI_OK(MIMPI_Send(data, 1, 1, 2));
+            }
+            ASSERT_MIMPI_OK(MIMPI_Recv(data, 100, 1, 1));
+        }
+        // Failed calls aren't recorded.
+        ASSERT_MIMPI_RETCODE(MIMPI_Recv_timeout(data, 100, 1, 1, 10), MIMPI_ERROR_TIMEOUT);
+        long long p50 = percentile(MIMPI_LATENCY_RECV_MATCH, 50, &calls);
+        long long p99 = percentile(MIMPI_LATENCY_RECV_MATCH, 99, NULL);
+        long long p100 = percentile(MIMPI_LATENCY_RECV_MATCH, 100, NULL);
+        assert(calls == ROUNDS);
+        assert(p50 <= p99 && p99 <= p100 && p100 >= 50000000);
+        percentile(MIMPI_LATENCY_RECV_COPY, 50, &calls);
+        assert(calls == ROUNDS);
+    }
+
+    for (int i = 0; i < ROUNDS; ++i) {
+        ASSERT_MIMPI_OK(MIMPI_Barrier());
+        ASSERT_MIMPI_OK(MIMPI_Bcast(data, 100, 0));
+        ASSERT_MIMPI_OK(MIMPI_Reduce(data, sum, 100, MIMPI_SUM, 0));
+    }
+    MIMPI_Latency collectives[] = {MIMPI_LATENCY_BARRIER, MIMPI_LATENCY_BCAST, MIMPI_LATENCY_REDUCE};
+    for (int i = 0; i < 3; ++i) {
+        long long p50 = percentile(collectives[i], 50, &calls);
+        long long p999 = percentile(collectives[i], 99.9, NULL);
+        assert(calls == ROUNDS);
+        assert(p50 <= p999);
+    }
+
+    MIMPI_Finalize();
+    return test_success();
+}
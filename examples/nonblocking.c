@@ -0,0 +1,65 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "test.h"
+#include "../mimpi.h"
+#include "mimpi_err.h"
+
+int main(int argc, char **argv) {
+    MIMPI_Init(false);
+    int rank = MIMPI_World_rank();
+    int size = MIMPI_World_size();
+
+    uint8_t send_data[2] = {rank + 1, rank};
+    uint8_t reduced[2] = {0, 0};
+    uint8_t broadcast[2] = {0, 0};
+    if (rank == 0) {
+        broadcast[0] = 7;
+        broadcast[1] = 42;
+    }
+    MIMPI_Request reduce_request;
+    MIMPI_Request bcast_request;
+    ASSERT_MIMPI_OK(MIMPI_Ireduce(send_data, reduced, 2, MIMPI_SUM, size - 1, &reduce_request));
+    ASSERT_MIMPI_OK(MIMPI_Ibcast(broadcast, 2, 0, &bcast_request));
+
+    // A blocking collective called later has to match after the nonblocking ones.
+    uint8_t value = rank == size / 2 ? 13 : 0;
+    ASSERT_MIMPI_OK(MIMPI_Bcast(&value, 1, size / 2));
+    test_assert(value == 13);
+
+    ASSERT_MIMPI_OK(MIMPI_Wait(&bcast_request));
+    test_assert(bcast_request == NULL);
+    test_assert(broadcast[0] == 7 && broadcast[1] == 42);
+    ASSERT_MIMPI_OK(MIMPI_Wait(&reduce_request));
+    if (rank == size - 1) {
+        test_assert(reduced[0] == (uint8_t)(size * (size + 1) / 2));
+        test_assert(reduced[1] == (uint8_t)(size * (size - 1) / 2));
+    }
+
+    // Point-to-point messages can be exchanged while a barrier is in progress.
+    MIMPI_Request barrier_request;
+    ASSERT_MIMPI_OK(MIMPI_Ibarrier(&barrier_request));
+    if (size > 1) {
+        int next = (rank + 1) % size;
+        int prev = (rank + size - 1) % size;
+        int token = rank;
+        ASSERT_MIMPI_OK(MIMPI_Send(&token, sizeof(int), next, 5));
+        ASSERT_MIMPI_OK(MIMPI_Recv(&token, sizeof(int), prev, 5));
+        test_assert(token == prev);
+    }
+    bool done = false;
+    while (!done) {
+        ASSERT_MIMPI_OK(MIMPI_Test(&barrier_request, &done));
+    }
+    test_assert(barrier_request == NULL);
+
+    MIMPI_Request invalid_request;
+    test_assert(MIMPI_Ibcast(broadcast, 2, size, &invalid_request) == MIMPI_ERROR_NO_SUCH_RANK);
+    ASSERT_MIMPI_OK(MIMPI_Wait(&invalid_request));
+
+    MIMPI_Finalize();
+    return test_success();
+}
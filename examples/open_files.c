@@ -0,0 +1,54 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "../mimpi.h"
+#include "mimpi_err.h"
+
+#define FILES 64
+
+static void open_files(int* files) {
+    for (int i = 0; i < FILES; ++i) {
+        files[i] = open("/dev/null", O_RDONLY);
+        assert(files[i] >= 0);
+    }
+}
+
+static void check_files(int* files) {
+    struct stat null_stat;
+    assert(stat("/dev/null", &null_stat) == 0);
+    for (int i = 0; i < FILES; ++i) {
+        struct stat file_stat;
+        assert(fstat(files[i], &file_stat) == 0);
+        assert(file_stat.st_rdev == null_stat.st_rdev && S_ISCHR(file_stat.st_mode));
+        assert(close(files[i]) == 0);
+    }
+}
+
+int main(int argc, char **argv) {
+    // Files opened before MIMPI_Init or before channels are set up must stay what they are,
+    // whatever the library puts in its own descriptors, and whenever the channels come.
+    int early_files[FILES];
+    open_files(early_files);
+    MIMPI_Init(false);
+    int rank = MIMPI_World_rank();
+    int size = MIMPI_World_size();
+
+    int files[FILES];
+    open_files(files);
+    int next = (rank + 1) % size;
+    int previous = (rank + size - 1) % size;
+    char token = 0;
+    if (size > 1) {
+        ASSERT_MIMPI_OK(MIMPI_Send(&token, 1, next, 1));
+        ASSERT_MIMPI_OK(MIMPI_Recv(&token, 1, previous, 1));
+    }
+    check_files(early_files);
+    check_files(files);
+
+    MIMPI_Finalize();
+    return test_success();
+}
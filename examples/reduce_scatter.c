@@ -0,0 +1,61 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "test.h"
+#include "../mimpi.h"
+#include "mimpi_err.h"
+
+int main(int argc, char **argv) {
+    MIMPI_Init(false);
+    int world_size = MIMPI_World_size();
+    int rank = MIMPI_World_rank();
+    {
+        // Byte i of the vector is rank + i in process rank.
+        int count = 3;
+        uint8_t data[count * world_size];
+        for (int i = 0; i < count * world_size; ++i) {
+            data[i] = rank + i;
+        }
+        uint8_t recv_data[count];
+        ASSERT_MIMPI_OK(MIMPI_Reduce_scatter_block(data, recv_data, count, MIMPI_MAX));
+        for (int j = 0; j < count; ++j) {
+            test_assert(recv_data[j] == (uint8_t)(world_size - 1 + rank * count + j));
+        }
+        ASSERT_MIMPI_OK(MIMPI_Reduce_scatter_block(data, recv_data, count, MIMPI_SUM));
+        for (int j = 0; j < count; ++j) {
+            int i = rank * count + j;
+            test_assert(recv_data[j] == (uint8_t)(world_size * i + world_size * (world_size - 1) / 2));
+        }
+    }
+    {
+        // Process i gets (i % 3) * 300 bytes of the result.
+        int counts[world_size];
+        int total = 0;
+        int offset = 0;
+        for (int i = 0; i < world_size; ++i) {
+            counts[i] = (i % 3) * 300;
+            if (i < rank) {
+                offset += counts[i];
+            }
+            total += counts[i];
+        }
+        uint8_t* data = malloc(total);
+        for (int i = 0; i < total; ++i) {
+            data[i] = (i + rank) % 5;
+        }
+        uint8_t* recv_data = malloc(counts[rank]);
+        ASSERT_MIMPI_OK(MIMPI_Reduce_scatter(data, recv_data, counts, MIMPI_MIN));
+        for (int j = 0; j < counts[rank]; ++j) {
+            // Minimum of x, x + 1, ..., x + world_size - 1 modulo 5.
+            int x = (offset + j) % 5;
+            test_assert(recv_data[j] == (x + world_size - 1 < 5 ? x : 0));
+        }
+        free(data);
+        free(recv_data);
+    }
+    MIMPI_Finalize();
+    return test_success();
+}
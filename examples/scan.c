@@ -0,0 +1,41 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "test.h"
+#include "../mimpi.h"
+#include "mimpi_err.h"
+
+int main(int argc, char **argv) {
+    MIMPI_Init(false);
+    int rank = MIMPI_World_rank();
+    uint8_t data[3] = {rank + 1, 1, 20 - rank};
+    uint8_t recv_data[3] = {0, 0, 0};
+
+    ASSERT_MIMPI_OK(MIMPI_Scan(data, recv_data, 3, MIMPI_SUM));
+    test_assert(recv_data[0] == (uint8_t)((rank + 1) * (rank + 2) / 2));
+    test_assert(recv_data[1] == rank + 1);
+
+    ASSERT_MIMPI_OK(MIMPI_Scan(data, recv_data, 3, MIMPI_MIN));
+    test_assert(recv_data[0] == 1);
+    test_assert(recv_data[2] == 20 - rank);
+
+    recv_data[0] = recv_data[1] = recv_data[2] = 42;
+    ASSERT_MIMPI_OK(MIMPI_Exscan(data, recv_data, 3, MIMPI_SUM));
+    if (rank == 0) {
+        test_assert(recv_data[0] == 42 && recv_data[1] == 42 && recv_data[2] == 42);
+    } else {
+        test_assert(recv_data[0] == (uint8_t)(rank * (rank + 1) / 2));
+        test_assert(recv_data[1] == rank);
+    }
+
+    ASSERT_MIMPI_OK(MIMPI_Exscan(data, recv_data, 3, MIMPI_MAX));
+    if (rank > 0) {
+        test_assert(recv_data[0] == rank);
+        test_assert(recv_data[2] == 20);
+    }
+    MIMPI_Finalize();
+    return test_success();
+}
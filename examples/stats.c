@@ -0,0 +1,52 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "test.h"
+#include "../mimpi.h"
+#include "mimpi_err.h"
+
+int main(int argc, char **argv) {
+    MIMPI_Init(false);
+    int rank = MIMPI_World_rank();
+    int size = MIMPI_World_size();
+    MIMPI_Stats stats;
+    MIMPI_Peer_stats* peers = malloc(size * sizeof(MIMPI_Peer_stats));
+    uint8_t data[100] = {0};
+
+    // Everyone sends 3 messages of 10, 20 and 30 bytes to the next one, which receives the last first.
+    int next = (rank + 1) % size;
+    int previous = (rank + size - 1) % size;
+    if (size > 1) {
+        for (int tag = 1; tag <= 3; ++tag) {
+            ASSERT_MIMPI_OK(MIMPI_Send(data, 10 * tag, next, tag));
+        }
+        ASSERT_MIMPI_OK(MIMPI_Recv(data, 30, previous, 3));
+        ASSERT_MIMPI_OK(MIMPI_Get_stats(&stats, peers));
+        assert(peers[next].messages_sent == 3);
+        assert(peers[next].bytes_sent == 60);
+        assert(peers[previous].messages_received == 3);
+        assert(peers[previous].bytes_received == 60);
+        assert(peers[previous].queue_depth == 2);
+        assert(peers[previous].queue_high_water >= 3);
+        assert(peers[rank].messages_sent == 0);
+        ASSERT_MIMPI_OK(MIMPI_Recv(data, 10, previous, 1));
+        ASSERT_MIMPI_OK(MIMPI_Recv(data, 20, previous, 2));
+        ASSERT_MIMPI_OK(MIMPI_Get_stats(&stats, peers));
+        assert(peers[previous].queue_depth == 0);
+    }
+
+    ASSERT_MIMPI_OK(MIMPI_Bcast(data, 100, 0));
+    ASSERT_MIMPI_OK(MIMPI_Get_stats(&stats, NULL));
+    assert(stats.deadlock_messages == 0);
+    if (size > 1) {
+        assert(stats.chunks_sent > 0);
+        assert(stats.write_calls >= stats.chunks_sent);
+        assert(stats.read_calls > 0);
+    }
+
+    free(peers);
+    MIMPI_Finalize();
+    return test_success();
+}
@@ -0,0 +1,109 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "../mimpi.h"
+#include "mimpi_err.h"
+
+// Keeps everyone until all have met the process that stayed out of a collective,
+// so that none of them sees the others finish while its own call is still timing out.
+static void meet(int absent) {
+    uint8_t value = 0;
+    if (MIMPI_World_rank() == absent) {
+        for (int i = 0; i < MIMPI_World_size(); ++i) {
+            if (i != absent) {
+                ASSERT_MIMPI_OK(MIMPI_Recv(&value, 1, i, 3));
+            }
+        }
+        for (int i = 0; i < MIMPI_World_size(); ++i) {
+            if (i != absent) {
+                ASSERT_MIMPI_OK(MIMPI_Send(&value, 1, i, 4));
+            }
+        }
+    } else {
+        ASSERT_MIMPI_OK(MIMPI_Send(&value, 1, absent, 3));
+        ASSERT_MIMPI_OK(MIMPI_Recv(&value, 1, absent, 4));
+    }
+}
+
+int main(int argc, char **argv) {
+    MIMPI_Init(false);
+    int rank = MIMPI_World_rank();
+    int size = MIMPI_World_size();
+    uint8_t value = 0;
+
+    // Nothing is sent before the barrier, and a message that comes after the timeout is still received later.
+    if (rank == 0) {
+        ASSERT_MIMPI_RETCODE(MIMPI_Recv_timeout(&value, 1, 1, 1, 50), MIMPI_ERROR_TIMEOUT);
+    }
+    ASSERT_MIMPI_OK(MIMPI_Barrier_timeout(5000));
+    if (rank == 1) {
+        value = 17;
+        ASSERT_MIMPI_OK(MIMPI_Send(&value, 1, 0, 1));
+    }
+    if (rank == 0) {
+        ASSERT_MIMPI_OK(MIMPI_Recv(&value, 1, 1, 1));
+        assert(value == 17);
+    }
+
+    // A late sender or root is fine as long as it comes in time.
+    if (rank == 1) {
+        usleep(50000);
+        value = 23;
+        ASSERT_MIMPI_OK(MIMPI_Send(&value, 1, 0, 2));
+    }
+    if (rank == 0) {
+        ASSERT_MIMPI_OK(MIMPI_Recv_timeout(&value, 1, 1, 2, 5000));
+        assert(value == 23);
+    }
+    if (rank == size - 1) {
+        usleep(50000);
+        value = 42;
+    }
+    ASSERT_MIMPI_OK(MIMPI_Bcast_timeout(&value, 1, size - 1, 5000));
+    assert(value == 42);
+    uint8_t one = 1;
+    uint8_t sum = 0;
+    ASSERT_MIMPI_OK(MIMPI_Reduce_timeout(&one, &sum, 1, MIMPI_SUM, 0, 5000));
+    if (rank == 0) {
+        assert(sum == size);
+    }
+
+    // A timed-out collective leaves the processes out of step, so each run lets only the one
+    // picked by the argument expire, and they meet again with point-to-point messages.
+    char const* expiring = argc > 1 ? argv[1] : "barrier";
+    if (strcmp(expiring, "barrier") == 0) {
+        // The others never come to this barrier, but stay until it has timed out.
+        if (rank == 0) {
+            ASSERT_MIMPI_RETCODE(MIMPI_Barrier_timeout(50), MIMPI_ERROR_TIMEOUT);
+            for (int i = 1; i < size; ++i) {
+                ASSERT_MIMPI_OK(MIMPI_Send(&value, 1, i, 3));
+            }
+        } else {
+            ASSERT_MIMPI_OK(MIMPI_Recv(&value, 1, 0, 3));
+        }
+    } else if (strcmp(expiring, "bcast") == 0) {
+        // The root never comes, so no other process gets the data in time.
+        int root = size - 1;
+        if (rank != root) {
+            ASSERT_MIMPI_RETCODE(MIMPI_Bcast_timeout(&value, 1, root, 50), MIMPI_ERROR_TIMEOUT);
+        }
+        meet(root);
+    } else if (strcmp(expiring, "reduce") == 0) {
+        // The last process never comes, so the root misses its part, and so may those between them.
+        int absent = size - 1;
+        if (rank != absent) {
+            MIMPI_Retcode ret = MIMPI_Reduce_timeout(&one, &sum, 1, MIMPI_SUM, 0, 50);
+            assert(ret == MIMPI_ERROR_TIMEOUT || (rank != 0 && ret == MIMPI_SUCCESS));
+        }
+        meet(absent);
+    } else {
+        assert(false);
+    }
+
+    MIMPI_Finalize();
+    return test_success();
+}
@@ -2,11 +2,19 @@
  * This file is for implementation of MIMPI library.
  * */
 #include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
 #include <limits.h>
+#include <poll.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
 #include "channel.h"
 #include "mimpi.h"
 #include "mimpi_common.h"
@@ -15,14 +23,76 @@
 struct metadata {
     int count;
     int tag;
+    int context;
 };
 
 typedef struct metadata metadata_t;
 
+// Context of messages in MIMPI_COMM_WORLD; every other communicator gets its own.
+#define WORLD_CONTEXT 0
+
+// Tags below zero are reserved for messages the library exchanges by itself.
+enum {
+    DEADLOCK_TAG = -1,
+    BARRIER_TAG = -2,
+    ALLGATHER_TAG = -3,
+    ALLTOALL_TAG = -4,
+    REDUCE_SCATTER_TAG = -5,
+    SCAN_TAG = -6,
+    COMM_BARRIER_TAG = -7,
+    COMM_BCAST_TAG = -8,
+    COMM_REDUCE_TAG = -9,
+    COMM_SPLIT_TAG = -10,
+    GATHER_TAG = -11,
+    SCATTER_TAG = -12,
+};
+
+// Largest block for which MIMPI_Allgather uses Bruck's algorithm rather than the ring.
+#define ALLGATHER_BRUCK_LIMIT 256
+
+// Largest block for which MIMPI_Alltoall uses Bruck's algorithm rather than pairwise exchange.
+#define ALLTOALL_BRUCK_LIMIT 32
+
+typedef enum {
+    BARRIER_TREE,
+    BARRIER_DISSEMINATION,
+    BARRIER_SHARED,
+} barrier_backend_t;
+
+// Largest packet sent over a packet channel (MIMPI_TRANSPORT=seqpacket); longer messages are split.
+// The first packet of a message starts with its header.
+#define PACKET_SIZE (64 * 1024)
+
+// Entries per peer of the ledger of sent messages kept for deadlock detection.
+#define LEDGER_SLOTS 64
+
+// Size of the buffer into which a receiver reads from a stream channel. Reads of channels are charged for every
+// block of 512 bytes they ask for (CHANNELS_READ_DELAY), so no read asks for more than one block.
+#define STAGING_SIZE 512
+
+// Packets submitted to the ring at once when sending with MIMPI_IO=uring.
+#define URING_ENTRIES 64
+
+// Receivers only copy messages into queues, so they get small stacks to let big worlds fit in memory.
+#define RECEIVER_STACK_SIZE (64 * 1024)
+
+// Iterations of busy waiting in the shared memory barrier before going to sleep on the futex.
+#define BARRIER_SPIN 2000
+
+// Events kept by the tracer of every process (MIMPI_TRACE); older ones are overwritten.
+#define TRACE_EVENTS (64 * 1024)
+
+// Latency histograms split every power of two above 2^LATENCY_SUB_BITS ns into 2^LATENCY_SUB_BITS buckets,
+// and go up to 2^LATENCY_MAX_BITS ns (about 37 minutes); longer calls fall into the last bucket.
+#define LATENCY_SUB_BITS 5
+#define LATENCY_MAX_BITS 41
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+
 struct node {
     void *data;
     int tag;
     int count;
+    int context;
     struct node *next;
     struct node *prev;
 };
@@ -56,11 +126,12 @@ queue_t* new_queue() {
     return ret_val;
 }
 
-void add_node(queue_t* queue, void* data, int count, int tag) {
+void add_node(queue_t* queue, void* data, int count, int tag, int context) {
     node_t* new_node = malloc(sizeof(node_t));
     new_node->data = data;
     new_node->tag = tag;
     new_node->count = count;
+    new_node->context = context;
     new_node->next = queue->tail;
     new_node->prev = queue->tail->prev;
     queue->tail->prev->next = new_node;
@@ -108,15 +179,178 @@ static void perform_op(void* src1, void* src2, int count, MIMPI_Op op) {
 
 
 
+// Counters for MIMPI_Get_stats. They are updated relaxed from whichever thread does the work,
+// so a snapshot may be slightly behind, but they cost no locks.
+typedef struct {
+    atomic_llong messages_sent;
+    atomic_llong bytes_sent;
+    atomic_llong messages_received;
+    atomic_llong bytes_received;
+    int queue_depth;      // under queue_mutex
+    int queue_high_water; // under queue_mutex
+} peer_stats_t;
+
+static struct {
+    atomic_llong recv_blocked_ns;
+    atomic_llong collective_ns;
+    atomic_llong chunks_sent;
+    atomic_llong chunks_received;
+    atomic_llong write_calls;
+    atomic_llong read_calls;
+    atomic_llong deadlock_messages;
+    atomic_llong deadlock_searches;
+} stats;
+static peer_stats_t* peer_stats;
+
+static void add_stat(atomic_llong* counter, long long value) {
+    atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+}
+
+static long long now_ns() {
+    struct timespec now;
+    ASSERT_SYS_OK(clock_gettime(CLOCK_MONOTONIC, &now));
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+// Latencies of calls, in fixed memory: a histogram of log-scale buckets per kind, each bucket within about 3%
+// of its values, as in HdrHistogram. Recording is a few relaxed increments, so percentiles read while other
+// threads record may be slightly behind.
+typedef struct {
+    atomic_llong buckets[LATENCY_BUCKETS];
+    atomic_llong calls;
+    atomic_llong max_ns;
+} latency_t;
+
+static latency_t latencies[MIMPI_LATENCY_KINDS];
+
+static int latency_bucket(long long ns) {
+    if (ns < 0) {
+        ns = 0;
+    }
+    if (ns >= 1LL << LATENCY_MAX_BITS) {
+        ns = (1LL << LATENCY_MAX_BITS) - 1;
+    }
+    int shift = ns == 0 ? 0 : max(63 - __builtin_clzll(ns) - LATENCY_SUB_BITS, 0);
+    return (shift << LATENCY_SUB_BITS) + (int)(ns >> shift);
+}
+
+// The highest latency that falls into the bucket.
+static long long latency_bucket_top(int bucket) {
+    int shift = max((bucket >> LATENCY_SUB_BITS) - 1, 0);
+    long long first = bucket - (shift << LATENCY_SUB_BITS);
+    return ((first + 1) << shift) - 1;
+}
+
+static void record_latency(MIMPI_Latency kind, long long ns) {
+    latency_t* latency = &latencies[kind];
+    add_stat(&latency->buckets[latency_bucket(ns)], 1);
+    add_stat(&latency->calls, 1);
+    long long longest = atomic_load_explicit(&latency->max_ns, memory_order_relaxed);
+    while (ns > longest
+           && !atomic_compare_exchange_weak_explicit(&latency->max_ns, &longest, ns, memory_order_relaxed,
+                                                     memory_order_relaxed)) {
+    }
+}
+
+// Records the latency of a call started at the given time, if it succeeded.
+static MIMPI_Retcode latency_done(MIMPI_Latency kind, long long started, MIMPI_Retcode ret) {
+    if (ret == MIMPI_SUCCESS) {
+        record_latency(kind, now_ns() - started);
+    }
+    return ret;
+}
+
+static long long latency_percentile(MIMPI_Latency kind, double percentile, long long* calls) {
+    latency_t* latency = &latencies[kind];
+    long long recorded = atomic_load_explicit(&latency->calls, memory_order_relaxed);
+    if (calls != NULL) {
+        *calls = recorded;
+    }
+    if (recorded == 0) {
+        return 0;
+    }
+    // The smallest number of calls that makes up the percentile, and at least one.
+    long long wanted = (long long)(percentile / 100 * recorded + 0.999999);
+    if (wanted < 1) {
+        wanted = 1;
+    }
+    long long seen = 0;
+    long long longest = atomic_load_explicit(&latency->max_ns, memory_order_relaxed);
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; ++bucket) {
+        seen += atomic_load_explicit(&latency->buckets[bucket], memory_order_relaxed);
+        if (seen >= wanted) {
+            long long top = latency_bucket_top(bucket);
+            return top < longest ? top : longest;
+        }
+    }
+    return longest;
+}
+
+// With MIMPI_TRACE set to a directory, calls and messages queued by receivers are recorded in a ring buffer, whose
+// newest TRACE_EVENTS events are left there in MIMPI_Finalize for mimpirun to merge into a Chrome trace. Any thread
+// takes the next slot with an atomic increment; when tracing is off, each traced call or message costs a single branch.
+typedef struct {
+    long long time_ns;
+    char const* name;
+    char phase; // 'B' and 'E' around a call, 'I' for an enqueued message
+    int thread;
+    int from;
+    int tag;
+    int count;
+} trace_event_t;
+
+static bool tracing;
+static trace_event_t* trace_events;
+static atomic_ullong trace_next;
+// Track of the thread: 0 for calls, 1 + peer for receivers, and the size of the world + 1 for the progress thread.
+static _Thread_local int trace_thread;
+
+static void trace_event(char phase, char const* name, int from, int tag, int count) {
+    unsigned long long next = atomic_fetch_add_explicit(&trace_next, 1, memory_order_relaxed);
+    trace_event_t* event = &trace_events[next % TRACE_EVENTS];
+    event->time_ns = now_ns();
+    event->name = name;
+    event->phase = phase;
+    event->thread = trace_thread;
+    event->from = from;
+    event->tag = tag;
+    event->count = count;
+}
+
+// Returns what the call returns, recording it between begin and end events when tracing, which is tested only once.
+#define TRACED(name, call)                                 \
+    do {                                                   \
+        if (tracing) {                                     \
+            trace_event('B', name, 0, 0, 0);               \
+            MIMPI_Retcode traced_ret_ = call;              \
+            trace_event('E', name, 0, 0, 0);               \
+            return traced_ret_;                            \
+        }                                                  \
+        return call;                                       \
+    } while (0)
+
+// Channels to processes on other hosts are sockets, which may report a peer that has gone away
+// with ECONNRESET rather than end of file.
+static int recv_fn(int read_fd, void* data, int count) {
+    add_stat(&stats.read_calls, 1);
+    int ret = chrecv(read_fd, data, count);
+    if (ret == -1 && errno == ECONNRESET) {
+        return 0;
+    }
+    return ret;
+}
+
 static MIMPI_Retcode send_data_fn(int send_fd, int count, void* data) {
     int sent_bytes;
     int bytes_to_send = count;
     while (bytes_to_send != 0) {
         void* package = malloc(512);
         memcpy(package, data + count - bytes_to_send, min(bytes_to_send, 512));
+        add_stat(&stats.chunks_sent, 1);
+        add_stat(&stats.write_calls, 1);
         sent_bytes = chsend(send_fd, package, min(bytes_to_send, 512));
         if (sent_bytes == -1) {
-            if (errno == EPIPE) {
+            if (errno == EPIPE || errno == ECONNRESET) {
                 free(package);
                 return MIMPI_ERROR_REMOTE_FINISHED;
             } else {
@@ -129,496 +363,3275 @@ static MIMPI_Retcode send_data_fn(int send_fd, int count, void* data) {
     return MIMPI_SUCCESS;
 }
 
-static MIMPI_Retcode read_data_fn(int read_fd, int count, void* data) {
-    int bytes_left = count;
-    int bytes_read;
-    while (bytes_left != 0) {
-        int msg_size = min(512, bytes_left);
-        ASSERT_SYS_OK(bytes_read = chrecv(read_fd, data + count - bytes_left, msg_size));
-        if (bytes_read == 0) {
+static MIMPI_Retcode send_packet_fn(int send_fd, void const* data, int count) {
+    add_stat(&stats.write_calls, 1);
+    if (chsend(send_fd, data, count) == -1) {
+        if (errno == EPIPE || errno == ECONNRESET) {
             return MIMPI_ERROR_REMOTE_FINISHED;
         }
-        bytes_left -= bytes_read;
+        ASSERT_SYS_OK(-1);
     }
     return MIMPI_SUCCESS;
 }
 
+// Ring through which packets of a single message are sent in linked batches (MIMPI_IO=uring),
+// one io_uring_enter for up to URING_ENTRIES packets of it instead of a write for each.
+// Only packet channels, to processes on the same host, use it: the ones made by channel() must be written
+// with chsend. Receives still read one packet at a time. There's one ring per process, shared by the threads
+// that send: they take turns only to submit and to hand out completions, not while their packets are on the way.
+typedef struct {
+    int fd;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    atomic_uint* sq_tail;
+    unsigned sq_mask;
+    unsigned* sq_array;
+    atomic_uint* cq_head;
+    atomic_uint* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+} uring_t;
 
-static int size;
-static int rank;
-static bool deadlock_detection;
-static queue_t* deadlock_queues[16];
-static pthread_mutex_t deadlock_mutex[16];
-static bool finished[16];
-static queue_t* queues[16];
-static pthread_t threads[16];
-static pthread_mutex_t queue_mutex[16];
-static pthread_cond_t queue_cond[16];
-
-static MIMPI_Retcode check_deadlock(int destination) {
-
-    node_t* temp_node = queues[destination]->head;
-    while (temp_node->next != NULL) {
-        //printf("checking for deadlock\n");
-        if (temp_node->tag == -1) {
-            //printf("sussy baka\n");
-            metadata_t* meta = temp_node->data;
-            int count = meta->count;
-            int tag = meta->tag;
-            //printf("Waiting for count: %d, tag: %d from %d\n", count, tag, destination);
-            bool found = false;
-            node_t* temp_dnode = deadlock_queues[destination]->head;
-            while (temp_dnode->next != NULL) {
-                if (count == temp_dnode->count && ((tag == temp_dnode->tag) || (tag == 0 && temp_dnode > 0))) {
-                    temp_node = temp_node->next;
-                    remove_node(temp_node->prev);
-                    temp_dnode = temp_dnode->next;
-                    remove_node(temp_dnode->prev);
-                    found = true;
-                    break;
-                }
-                temp_dnode = temp_dnode->next;
-            }
-            if (!found) {
-                return MIMPI_ERROR_DEADLOCK_DETECTED;
-            }
-        } else {
-            temp_node = temp_node->next;
-        }
+// Packets of a message in the ring: how many haven't completed yet, and how they went.
+typedef struct {
+    unsigned pending;
+    MIMPI_Retcode ret;
+} uring_request_t;
+
+static bool use_uring;
+static uring_t uring;
+static pthread_mutex_t uring_mutex;
+static pthread_cond_t uring_cond;
+// Whether a thread waits in io_uring_enter for completions, to hand them out to whoever they belong to.
+static bool uring_reaping;
+
+// Returns false if io_uring isn't available (e.g. disabled in the kernel or by seccomp), in which case packets
+// are sent with chsend. Either way the placeholder mimpirun left in the ring's slot is gone afterwards.
+static bool uring_init() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = syscall(SYS_io_uring_setup, URING_ENTRIES, &params);
+    if (fd == -1) {
+        ASSERT_SYS_OK(close(determine_ring()));
+        return false;
     }
-    //printf("all good\n");
-    return MIMPI_SUCCESS;
+    // The library keeps its descriptors out of the range left to the user.
+    ASSERT_SYS_OK(dup2(fd, determine_ring()));
+    ASSERT_SYS_OK(close(fd));
+    fd = determine_ring();
+    uring.fd = fd;
+    uring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    uring.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    uring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    uring.sq_ring = mmap(NULL, uring.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    uring.cq_ring = mmap(NULL, uring.cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    uring.sqes = mmap(NULL, uring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (uring.sq_ring == MAP_FAILED || uring.cq_ring == MAP_FAILED || uring.sqes == MAP_FAILED) {
+        syserr("mmap of io_uring failed");
+    }
+    uring.sq_tail = uring.sq_ring + params.sq_off.tail;
+    uring.sq_mask = *(unsigned*)(uring.sq_ring + params.sq_off.ring_mask);
+    uring.sq_array = uring.sq_ring + params.sq_off.array;
+    uring.cq_head = uring.cq_ring + params.cq_off.head;
+    uring.cq_tail = uring.cq_ring + params.cq_off.tail;
+    uring.cq_mask = *(unsigned*)(uring.cq_ring + params.cq_off.ring_mask);
+    uring.cqes = uring.cq_ring + params.cq_off.cqes;
+    ASSERT_ZERO(pthread_mutex_init(&uring_mutex, NULL));
+    ASSERT_ZERO(pthread_cond_init(&uring_cond, NULL));
+    uring_reaping = false;
+    return true;
 }
 
-static void* worker_receiver(void *data) {
-    int from = *(int*)data;
-    free(data);
-    int read_fd = determine_read(rank, from);
-    //printf("from: %d read_fd: %d \n", from, read_fd);
-    //print_open_descriptors();
-
-    while(true) {
-        metadata_t* metadata = malloc(sizeof(metadata_t));
-        int bytes_read;
-        int bytes_left = sizeof(metadata_t);
-        while (bytes_left != 0) {
-            ASSERT_SYS_OK(bytes_read = chrecv(read_fd, metadata + sizeof(metadata_t) - bytes_left, bytes_left));
-            if (bytes_read == 0) {
-                free(metadata);
-                finished[from] = true;
-                pthread_cond_signal(&queue_cond[from]);
-                return NULL;
-            }
-            bytes_left -= bytes_read;
-        }
-        int count = metadata->count;
-        bytes_left = count;
-        int tag = metadata->tag;
-        free(metadata);
-        void* read_data = malloc(count);
+static void uring_finalize() {
+    ASSERT_SYS_OK(munmap(uring.sq_ring, uring.sq_ring_size));
+    ASSERT_SYS_OK(munmap(uring.cq_ring, uring.cq_ring_size));
+    ASSERT_SYS_OK(munmap(uring.sqes, uring.sqes_size));
+    ASSERT_SYS_OK(close(uring.fd));
+    ASSERT_ZERO(pthread_mutex_destroy(&uring_mutex));
+    ASSERT_ZERO(pthread_cond_destroy(&uring_cond));
+}
 
-        while (bytes_left != 0) {
-            int msg_size = min(512, bytes_left);
-            ASSERT_SYS_OK(bytes_read = chrecv(read_fd, read_data + count - bytes_left, msg_size));
-            if (bytes_read == 0) {
-                free(read_data);
-                ASSERT_ZERO(pthread_mutex_lock(&queue_mutex[from]));
-                finished[from] = true;
-                pthread_cond_signal(&queue_cond[from]);
-                ASSERT_ZERO(pthread_mutex_unlock(&queue_mutex[from]));
-                return NULL;
-            }
-            bytes_left -= bytes_read;
+// Hands out the completions in the ring to their requests, and wakes their threads. Called under uring_mutex.
+static void uring_reap() {
+    unsigned head = atomic_load_explicit(uring.cq_head, memory_order_relaxed);
+    unsigned cq_tail = atomic_load_explicit(uring.cq_tail, memory_order_acquire);
+    for (; head != cq_tail; ++head) {
+        struct io_uring_cqe* cqe = &uring.cqes[head & uring.cq_mask];
+        uring_request_t* request = (uring_request_t*)(unsigned long)cqe->user_data;
+        if (cqe->res == -EPIPE || cqe->res == -ECONNRESET) {
+            request->ret = MIMPI_ERROR_REMOTE_FINISHED;
+        } else if (cqe->res < 0 && cqe->res != -ECANCELED) {
+            errno = -cqe->res;
+            ASSERT_SYS_OK(-1);
         }
-        ASSERT_ZERO(pthread_mutex_lock(&queue_mutex[from]));
-        add_node(queues[from], read_data, count, tag);
-        ASSERT_ZERO(pthread_mutex_unlock(&queue_mutex[from]));
-        pthread_cond_signal(&queue_cond[from]);
+        --request->pending;
     }
+    atomic_store_explicit(uring.cq_head, head, memory_order_release);
+    pthread_cond_broadcast(&uring_cond);
 }
 
+// Sends packets in order, linked so that after a failed one the rest are cancelled, and waits for all of them.
+// The mutex is held only to submit them and to hand out completions, so that a slow peer doesn't hold up sends
+// to others: one waiting thread at a time sleeps in io_uring_enter, and the others on uring_cond.
+static MIMPI_Retcode uring_send(int send_fd, struct iovec const* packets, unsigned count) {
+    uring_request_t request = {.pending = count, .ret = MIMPI_SUCCESS};
+    ASSERT_ZERO(pthread_mutex_lock(&uring_mutex));
+    unsigned tail = atomic_load_explicit(uring.sq_tail, memory_order_relaxed);
+    for (unsigned i = 0; i < count; ++i) {
+        unsigned index = (tail + i) & uring.sq_mask;
+        struct io_uring_sqe* sqe = &uring.sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = send_fd;
+        sqe->addr = (unsigned long)packets[i].iov_base;
+        sqe->len = packets[i].iov_len;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->flags = i + 1 < count ? IOSQE_IO_LINK : 0;
+        sqe->user_data = (unsigned long)&request;
+        uring.sq_array[index] = index;
+    }
+    atomic_store_explicit(uring.sq_tail, tail + count, memory_order_release);
 
-
-void MIMPI_Init(bool enable_deadlock_detection) {
-    channels_init();
-    deadlock_detection = enable_deadlock_detection;
-    ASSERT_SYS_OK(size = strtol(getenv("MIMPI_SIZE"), NULL, 0));
-    ASSERT_SYS_OK(rank = strtol(getenv("MIMPI_RANK"), NULL, 0));
-    for (int i = 0; i < size; ++i) {
-        if (i != rank) {
-            finished[i] = false;
-            queues[i] = new_queue();
-            if (deadlock_detection) {
-                deadlock_queues[i] = new_queue();
-                ASSERT_ZERO(pthread_mutex_init(&deadlock_mutex[i], NULL));
+    // All of them are submitted before the mutex is let go, so the next thread finds the submission queue empty.
+    unsigned submitted = 0;
+    while (submitted < count) {
+        add_stat(&stats.write_calls, 1);
+        int entered = syscall(SYS_io_uring_enter, uring.fd, count - submitted, 0, 0, NULL, 0);
+        if (entered == -1) {
+            if (errno == EAGAIN || errno == EBUSY) {
+                uring_reap();
+            } else if (errno != EINTR) {
+                ASSERT_SYS_OK(-1);
             }
-            ASSERT_ZERO(pthread_mutex_init(&queue_mutex[i], NULL));
-            ASSERT_ZERO(pthread_cond_init(&queue_cond[i], NULL));
-            int* num = malloc(sizeof(int));
-            *num = i;
-            ASSERT_ZERO(pthread_create(&threads[i], NULL, worker_receiver, num));
+        } else {
+            submitted += entered;
         }
-
     }
+    while (request.pending > 0) {
+        if (uring_reaping) {
+            ASSERT_ZERO(pthread_cond_wait(&uring_cond, &uring_mutex));
+            continue;
+        }
+        // Completions that came before are still in the ring, so this returns at once if any of ours did.
+        uring_reaping = true;
+        ASSERT_ZERO(pthread_mutex_unlock(&uring_mutex));
+        if (syscall(SYS_io_uring_enter, uring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) == -1 && errno != EINTR) {
+            ASSERT_SYS_OK(-1);
+        }
+        ASSERT_ZERO(pthread_mutex_lock(&uring_mutex));
+        uring_reaping = false;
+        uring_reap();
+    }
+    ASSERT_ZERO(pthread_mutex_unlock(&uring_mutex));
+    return request.ret;
+}
 
+// Packets of a message waiting to be sent together.
+typedef struct {
+    int send_fd;
+    unsigned queued;
+    MIMPI_Retcode ret;
+    struct iovec packets[URING_ENTRIES];
+} packet_batch_t;
 
+static void flush_packets(packet_batch_t* batch) {
+    if (batch->queued > 0 && batch->ret == MIMPI_SUCCESS) {
+        batch->ret = uring_send(batch->send_fd, batch->packets, batch->queued);
+    }
+    batch->queued = 0;
 }
 
-void MIMPI_Finalize() {
-
-    if (group_num(rank, MIMPI_Father) >= 0) {
-        ASSERT_SYS_OK(close(determine_gwrite(MIMPI_Father)));
-        ASSERT_SYS_OK(close(determine_gread(MIMPI_Father)));                }
-    if (group_num(rank, MIMPI_Left) < size) {
-        ASSERT_SYS_OK(close(determine_gwrite(MIMPI_Left)));
-        ASSERT_SYS_OK(close(determine_gread(MIMPI_Left)));
+static void batch_packet(packet_batch_t* batch, void const* data, int count) {
+    if (batch->ret != MIMPI_SUCCESS) {
+        return;
     }
-    if (group_num(rank, MIMPI_Right) < size) {
-        ASSERT_SYS_OK(close(determine_gwrite(MIMPI_Right)));
-        ASSERT_SYS_OK(close(determine_gread(MIMPI_Right)));
+    if (!use_uring) {
+        batch->ret = send_packet_fn(batch->send_fd, data, count);
+        return;
     }
-    for (int i = 0; i < size; ++i) {
-        if (i != rank) {
-            ASSERT_SYS_OK(close(determine_write(rank, i)));
-        }
+    batch->packets[batch->queued].iov_base = (void*)data;
+    batch->packets[batch->queued].iov_len = count;
+    if (++batch->queued == URING_ENTRIES) {
+        flush_packets(batch);
     }
+}
 
-    for (int i = 0; i < size; ++i) {
-        if (i != rank) {
-            ASSERT_ZERO(pthread_join(threads[i], NULL));
-            ASSERT_ZERO(pthread_mutex_destroy(&queue_mutex[i]));
-            ASSERT_ZERO(pthread_cond_destroy(&queue_cond[i]));
-            ASSERT_SYS_OK(close(determine_read(rank, i)));
-            delete_queue(queues[i]);
-            if (deadlock_detection) {
-                delete_queue(deadlock_queues[i]);
-                ASSERT_ZERO(pthread_mutex_destroy(&deadlock_mutex[i]));
-            }
-        }
+// Deadline of the timed call running on this thread, on CLOCK_MONOTONIC, or NULL if it may wait forever.
+// The progress thread never has one, so nonblocking collectives aren't cut short.
+static _Thread_local struct timespec const* call_deadline;
+
+// Milliseconds left until the deadline, rounded up, or -1 without one, as poll takes it.
+static int remaining_ms() {
+    if (call_deadline == NULL) {
+        return -1;
     }
-    channels_finalize();
+    struct timespec now;
+    ASSERT_SYS_OK(clock_gettime(CLOCK_MONOTONIC, &now));
+    long long ms = (call_deadline->tv_sec - now.tv_sec) * 1000LL + (call_deadline->tv_nsec - now.tv_nsec + 999999) / 1000000;
+    return ms < 0 ? 0 : (int)(ms < INT_MAX ? ms : INT_MAX);
 }
 
-int MIMPI_World_size() {
-    return size;
+static struct timespec deadline_after(int timeout_ms) {
+    struct timespec deadline;
+    ASSERT_SYS_OK(clock_gettime(CLOCK_MONOTONIC, &deadline));
+    timeout_ms = max(timeout_ms, 0);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    return deadline;
 }
 
-int MIMPI_World_rank() {
-    return rank;
+// Condition variables are on CLOCK_MONOTONIC, to be waited on until a deadline.
+static void cond_init(pthread_cond_t* cond) {
+    pthread_condattr_t attr;
+    ASSERT_ZERO(pthread_condattr_init(&attr));
+    ASSERT_ZERO(pthread_condattr_setclock(&attr, CLOCK_MONOTONIC));
+    ASSERT_ZERO(pthread_cond_init(cond, &attr));
+    ASSERT_ZERO(pthread_condattr_destroy(&attr));
 }
 
-MIMPI_Retcode MIMPI_Send(
-    void const *data,
-    int count,
-    int destination,
-    int tag
-) {
-    if (destination == rank) {
-        return MIMPI_ERROR_ATTEMPTED_SELF_OP;
+// Returns false if the deadline has passed instead.
+static bool cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex) {
+    if (call_deadline == NULL) {
+        pthread_cond_wait(cond, mutex);
+        return true;
     }
-    if (destination >= size) {
-        return MIMPI_ERROR_NO_SUCH_RANK;
+    return pthread_cond_timedwait(cond, mutex, call_deadline) != ETIMEDOUT;
+}
+
+// Waits for data on a group channel until the deadline. Only poll is used, so the channel is still read by chrecv.
+static bool wait_readable(int fd) {
+    if (call_deadline == NULL) {
+        return true;
     }
-    int send_fd = determine_write(rank, destination);
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    int ready;
+    while ((ready = poll(&pfd, 1, remaining_ms())) == -1 && errno == EINTR) {
+    }
+    ASSERT_SYS_OK(ready);
+    return ready > 0;
+}
 
-    metadata_t* meta = malloc(sizeof(metadata_t));
-    meta->count = count;
-    meta->tag = tag;
-    int bytes_to_send = sizeof(metadata_t);
-    int sent_bytes;
-    while (bytes_to_send != 0) {
-        ASSERT_SYS_OK(sent_bytes = chsend(send_fd, meta + sizeof(metadata_t) - bytes_to_send, sizeof(metadata_t)));
-        if (errno == EPIPE) {
-            free(meta);
+static MIMPI_Retcode read_data_fn(int read_fd, int count, void* data) {
+    int bytes_left = count;
+    int bytes_read;
+    while (bytes_left != 0) {
+        int msg_size = min(512, bytes_left);
+        if (!wait_readable(read_fd)) {
+            return MIMPI_ERROR_TIMEOUT;
+        }
+        add_stat(&stats.chunks_received, 1);
+        ASSERT_SYS_OK(bytes_read = recv_fn(read_fd, data + count - bytes_left, msg_size));
+        if (bytes_read == 0) {
             return MIMPI_ERROR_REMOTE_FINISHED;
         }
-        bytes_to_send -= sent_bytes;
+        bytes_left -= bytes_read;
     }
-    free(meta);
-    bytes_to_send = count;
-    while (bytes_to_send != 0) {
-        void* package = malloc(512);
-        memcpy(package, data + count - bytes_to_send, min(bytes_to_send, 512));
-        sent_bytes = chsend(send_fd, package, min(bytes_to_send, 512));
-        if (errno == EPIPE) {
-            free(package);
-            return MIMPI_ERROR_REMOTE_FINISHED;
+    return MIMPI_SUCCESS;
+}
+
+// Returns false if the deadline of the call has passed instead.
+static bool futex_wait(atomic_int* addr, int value) {
+    struct timespec timeout;
+    struct timespec* relative = NULL;
+    if (call_deadline != NULL) {
+        int ms = remaining_ms();
+        if (ms == 0) {
+            return false;
         }
-        bytes_to_send -= sent_bytes;
-        free(package);
+        timeout.tv_sec = ms / 1000;
+        timeout.tv_nsec = (long)(ms % 1000) * 1000000;
+        relative = &timeout;
     }
-    if (deadlock_detection) {
-        int* trash = malloc(sizeof(int));
-        add_node(deadlock_queues[destination], trash, count, tag);
+    if (syscall(SYS_futex, addr, FUTEX_WAIT, value, relative, NULL, 0) == -1) {
+        if (errno == ETIMEDOUT) {
+            return false;
+        }
+        if (errno != EAGAIN && errno != EINTR) {
+            ASSERT_SYS_OK(-1);
+        }
     }
-    return MIMPI_SUCCESS;
+    return true;
 }
 
-MIMPI_Retcode MIMPI_Recv(
-    void *data,
-    int count,
-    int source,
-    int tag
-) {
-    if (source == rank) {
-        return MIMPI_ERROR_ATTEMPTED_SELF_OP;
+static void futex_wake(atomic_int* addr) {
+    ASSERT_SYS_OK(syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0));
+}
+
+static int size;
+static int rank;
+
+// Buffers for data of every child of this process, plus one spare buffer at index children.
+static void** new_children_data(int children, int count) {
+    void** data_array = malloc((children + 1) * sizeof(void*));
+    for (int i = 0; i <= children; ++i) {
+        data_array[i] = malloc(count);
+        memset(data_array[i], 0, count);
     }
-    if (source >= size) {
-        return MIMPI_ERROR_NO_SUCH_RANK;
+    return data_array;
+}
+
+static void delete_children_data(void** data_array, int children) {
+    for (int i = 0; i <= children; ++i) {
+        free(data_array[i]);
     }
-    bool done = false;
+    free(data_array);
+}
 
-    ASSERT_ZERO(pthread_mutex_lock(&queue_mutex[source]));
-    node_t* node = queues[source]->head->next;
-    bool first = true;
-    while (!done) {
-        while (node->next != NULL && !done) {
-            if ((node->tag == tag || (node->tag > 0 && tag == MIMPI_ANY_TAG)) && node->count == count) {
-                memcpy(data, node->data, count);
-                node = node->next;
-                remove_node(node->prev);
-                done = true;
-            } else {
-                node = node->next;
+// Reads from whichever child fd is ready until some child delivers all its data.
+// bytes_left[i] is the number of bytes out of counts[i] still expected from child i, or -1 once the child was reported.
+// The completed child's index is put in child, so the caller can combine results in completion order.
+static MIMPI_Retcode read_any_child_fn(int children, int const* counts, void** data_array, int bytes_left[], int* child) {
+    struct pollfd fds[children];
+    int index[children];
+    while (true) {
+        int nfds = 0;
+        for (int i = 0; i < children; ++i) {
+            if (bytes_left[i] == 0) {
+                bytes_left[i] = -1;
+                *child = i;
+                return MIMPI_SUCCESS;
+            }
+            if (bytes_left[i] > 0) {
+                fds[nfds].fd = determine_gread(MIMPI_Child + i);
+                fds[nfds].events = POLLIN;
+                fds[nfds].revents = 0;
+                index[nfds++] = i;
             }
         }
-        if (!done) {
-            //printf("checking for deadlock\n");
-            if (deadlock_detection) {
-                if (first) {
-                    //printf("sending deadlock message\n");
-                    metadata_t* metadata = malloc(sizeof(metadata_t));
-                    metadata->count = count;
-                    metadata->tag = tag;
-                    MIMPI_Send(metadata, sizeof(metadata_t), source, -1);
-                    free(metadata);
-                    //printf("deadlock message sent\n");
-                }
-                MIMPI_Retcode retcode = check_deadlock(source);
-                if (retcode == MIMPI_ERROR_DEADLOCK_DETECTED) {
-                    pthread_mutex_unlock(&queue_mutex[source]);
-                    return MIMPI_ERROR_DEADLOCK_DETECTED;
-                }
+        int ready;
+        ASSERT_SYS_OK(ready = poll(fds, nfds, remaining_ms()));
+        if (ready == 0) {
+            return MIMPI_ERROR_TIMEOUT;
+        }
+        for (int j = 0; j < nfds; ++j) {
+            if (fds[j].revents == 0) {
+                continue;
             }
-            if (finished[source]) {
-                pthread_mutex_unlock(&queue_mutex[source]);
+            int i = index[j];
+            int bytes_read;
+            add_stat(&stats.chunks_received, 1);
+            ASSERT_SYS_OK(bytes_read = recv_fn(fds[j].fd, data_array[i] + counts[i] - bytes_left[i], min(512, bytes_left[i])));
+            if (bytes_read == 0) {
                 return MIMPI_ERROR_REMOTE_FINISHED;
             }
-            node = node->prev;
-            pthread_cond_wait(&queue_cond[source], &queue_mutex[source]);
-            first = false;
+            bytes_left[i] -= bytes_read;
         }
     }
-    ASSERT_ZERO(pthread_mutex_unlock(&queue_mutex[source]));
-    return MIMPI_SUCCESS;
 }
 
-MIMPI_Retcode MIMPI_Barrier() {
-    void *data = malloc(1);
-    memset(data, 0, 1);
-    if (group_num(rank, MIMPI_Left) < size) {
-        if (read_data_fn(determine_gread(MIMPI_Left), 1, data) == MIMPI_ERROR_REMOTE_FINISHED) {
-            free(data);
-            return MIMPI_ERROR_REMOTE_FINISHED;
-        }
+// Reads counts[i] bytes from every child i into data_array[i], calling op (if given) on each child's data
+// as soon as it's complete.
+static MIMPI_Retcode read_children_counts_fn(int const* counts, void** data_array, void* acc, MIMPI_Op const* op) {
+    int children = group_children(rank);
+    if (children == 0) {
+        return MIMPI_SUCCESS;
     }
-    if (group_num(rank, MIMPI_Right) < size) {
-        if (read_data_fn(determine_gread(MIMPI_Right), 1, data) == MIMPI_ERROR_REMOTE_FINISHED) {
-            free(data);
-            return MIMPI_ERROR_REMOTE_FINISHED;
-        }
-    }
-    if (group_num(rank, MIMPI_Father) >= 0) {
-        if (send_data_fn(determine_gwrite(MIMPI_Father), 1, data)) {
-            free(data);
-            return MIMPI_ERROR_REMOTE_FINISHED;
-        }
-        if (read_data_fn(determine_gread(MIMPI_Father), 1, data) == MIMPI_ERROR_REMOTE_FINISHED) {
-            free(data);
-            return MIMPI_ERROR_REMOTE_FINISHED;
-        }
+    int bytes_left[children];
+    for (int i = 0; i < children; ++i) {
+        bytes_left[i] = counts[i];
     }
-    if (group_num(rank, MIMPI_Left) < size) {
-        if (send_data_fn(determine_gwrite(MIMPI_Left), 1, data)) {
-            free(data);
-            return MIMPI_ERROR_REMOTE_FINISHED;
+    for (int pending = children; pending > 0; --pending) {
+        int child;
+        MIMPI_Retcode ret = read_any_child_fn(children, counts, data_array, bytes_left, &child);
+        if (ret != MIMPI_SUCCESS) {
+            return ret;
         }
-    }
-    if (group_num(rank, MIMPI_Right) < size) {
-        if (send_data_fn(determine_gwrite(MIMPI_Right), 1, data)) {
-            free(data);
-            return MIMPI_ERROR_REMOTE_FINISHED;
+        if (op != NULL) {
+            perform_op(acc, data_array[child], counts[child], *op);
         }
     }
-    free(data);
     return MIMPI_SUCCESS;
 }
 
-MIMPI_Retcode MIMPI_Bcast(
-    void *data,
-    int count,
-    int root
-) {
-    if (root >= size) {
-        return MIMPI_ERROR_NO_SUCH_RANK;
-    }
-    int root_path;
-    int tmp = root + 1;
-    while (tmp > 0 && tmp != group_num(rank, MIMPI_Left) + 1) {
-        tmp /= 2;
-    }
-    if (tmp == group_num(rank, MIMPI_Left) + 1) {
-        root_path = 0;
-    } else {
-        root_path = 1;
-    }
-    void* data_array[2];
-    data_array[0] = malloc(count);
-    data_array[1] = malloc(count);
-    memset(data_array[0], 0, count);
-    memset(data_array[1], 0, count);
-    if (group_num(rank, MIMPI_Left) < size) {
-        if (read_data_fn(determine_gread(MIMPI_Left), count, data_array[0]) == MIMPI_ERROR_REMOTE_FINISHED) {
-            free(data_array[0]);
-            free(data_array[1]);
-            return MIMPI_ERROR_REMOTE_FINISHED;
-        }
+static MIMPI_Retcode read_children_fn(int count, void** data_array, void* acc, MIMPI_Op const* op) {
+    int children = group_children(rank);
+    int counts[children + 1];
+    for (int i = 0; i < children; ++i) {
+        counts[i] = count;
     }
-    if (group_num(rank, MIMPI_Right) < size) {
-        if (read_data_fn(determine_gread(MIMPI_Right), count, data_array[1]) == MIMPI_ERROR_REMOTE_FINISHED) {
-            free(data_array[0]);
-            free(data_array[1]);
+    return read_children_counts_fn(counts, data_array, acc, op);
+}
+
+static MIMPI_Retcode send_children_fn(int count, void* data) {
+    for (int i = 0; i < group_children(rank); ++i) {
+        if (send_data_fn(determine_gwrite(MIMPI_Child + i), count, data) == MIMPI_ERROR_REMOTE_FINISHED) {
             return MIMPI_ERROR_REMOTE_FINISHED;
         }
     }
+    return MIMPI_SUCCESS;
+}
 
-    void* data_to_send;
-    if (rank == root) {
-        data_to_send = data;
-    } else {
-        data_to_send = data_array[root_path];
-    }
-    if (group_num(rank, MIMPI_Father) >= 0) {
+static bool deadlock_detection;
+static barrier_backend_t barrier_backend;
+static shared_barrier_t* shared_barrier;
+static int local_sense;
+// Per peer state, indexed by rank and allocated in MIMPI_Init for the size of the world.
+static pthread_mutex_t* deadlock_mutex;
+static bool* finished;
+static queue_t** queues;
+static pthread_t* threads;
+static pthread_mutex_t* queue_mutex;
+static pthread_cond_t* queue_cond;
+// Serialises whole messages to a peer, as collectives in the progress thread send alongside the user's thread.
+static pthread_mutex_t* send_mutex;
 
-        if (send_data_fn(determine_gwrite(MIMPI_Father), count, data_to_send) == MIMPI_ERROR_REMOTE_FINISHED) {
-            free(data_array[0]);
-            free(data_array[1]);
-            return MIMPI_ERROR_REMOTE_FINISHED;
-        }
+// With MIMPI_CONNECT=lazy, channels with a peer are requested from mimpirun's broker before the first message to it,
+// and received by the connector thread, which also starts the peer's receiver. Until then placeholders left by
+// mimpirun keep their slots taken, so that nothing opened in the meantime lands there and is overwritten.
+enum {
+    PEER_UNCONNECTED,
+    PEER_REQUESTED,
+    PEER_CONNECTED,
+    PEER_GONE,
+};
 
-        if (read_data_fn(determine_gread(MIMPI_Father), count, data_array[root_path]) == MIMPI_ERROR_REMOTE_FINISHED) {
-            free(data_array[0]);
-            free(data_array[1]);
+static bool lazy;
+static bool packet;
+static int* connect_state;
+static pthread_mutex_t connect_mutex;
+static pthread_cond_t connect_cond;
+static pthread_t connector;
+
+typedef enum {
+    REQUEST_BARRIER,
+    REQUEST_BCAST,
+    REQUEST_REDUCE,
+} request_kind_t;
+
+struct mimpi_request {
+    request_kind_t kind;
+    void const *send_data;
+    void *data;
+    int count;
+    MIMPI_Op op;
+    int root;
+    bool done;
+    MIMPI_Retcode retcode;
+    struct mimpi_request *next;
+};
+
+// Nonblocking collectives in the order they were called. The head stays here
+// while the progress thread runs it, so the list is empty only when all of them completed.
+static struct mimpi_request* collectives_head;
+static struct mimpi_request* collectives_tail;
+static pthread_mutex_t collectives_mutex;
+static pthread_cond_t collectives_cond;
+static pthread_t progress_thread;
+static bool progress_running;
+static bool progress_stopping;
+
+struct mimpi_comm {
+    int context;
+    int size;
+    int rank;
+    int* ranks; // world rank of every process in the communicator
+};
+
+static struct mimpi_comm world_comm;
+MIMPI_Comm const MIMPI_COMM_WORLD = &world_comm;
+// Smallest context this process hasn't used yet; new communicators take the largest among their parent's processes.
+static int next_context;
+
+static void stop_progress() {
+    ASSERT_ZERO(pthread_mutex_lock(&collectives_mutex));
+    bool running = progress_running;
+    progress_stopping = true;
+    pthread_cond_broadcast(&collectives_cond);
+    ASSERT_ZERO(pthread_mutex_unlock(&collectives_mutex));
+    if (running) {
+        ASSERT_ZERO(pthread_join(progress_thread, NULL));
+    }
+}
+
+// Deadlock detection follows Chandy, Misra and Haas: a process blocked in MIMPI_Recv waits for its source, and one
+// blocked in MIMPI_Barrier, MIMPI_Bcast or MIMPI_Reduce waits for every process that hasn't entered that collective.
+// Probes travel along these edges as DEADLOCK_TAG messages, which receivers handle instead of queueing; a probe that
+// comes back to the process which started it, still blocked the same way, has closed a cycle.
+//
+// Every edge is checked by the process it leads to: messages are counted, so it sees if it has already sent one
+// that will end the wait. A process that isn't blocked drops probes, remembering who sent them, and nudges those
+// processes when it blocks, so that they probe again.
+//
+// A detected cycle is first doomed and then released, going back along the path of the probe, so that no process
+// leaves it before all have stopped forwarding probes. Released processes in MIMPI_Recv return
+// MIMPI_ERROR_DEADLOCK_DETECTED; collectives can't be interrupted and keep waiting.
+//
+// When all processes run on one host, they publish their waits in a table shared by mimpirun instead, and look for
+// a cycle through themselves whenever they block or receive a message that doesn't end the wait, without sending
+// anything. The last process to change its wait in a cycle finds it, and only the processes it releases get a message.
+typedef enum {
+    WAIT_NONE,
+    WAIT_RECV,
+    WAIT_COLLECTIVE,
+} wait_kind_t;
+
+typedef enum {
+    CONTROL_PROBE,
+    CONTROL_NUDGE,
+    CONTROL_DOOM,
+    CONTROL_RELEASE,
+} control_kind_t;
+
+typedef struct {
+    control_kind_t kind;
+    int initiator;
+    int epoch;        // wait of the initiator, or of the nudged process
+    int round;        // probe of the initiator, so that a process forwards it once
+    int sender_epoch; // wait of the sender, to nudge it later
+    wait_kind_t waiting;
+    int received;     // receive: messages the sender had received from us; collective: its number
+    int count;
+    int tag;
+    int context;
+} control_t;
+
+typedef struct {
+    int destination;
+    control_t message;
+} outgoing_t;
+
+typedef struct {
+    int count;
+    int tag;
+    int context;
+    int sequence; // 0 in an empty slot
+} sent_entry_t;
+
+typedef struct {
+    wait_kind_t kind;
+    int epoch;
+    int source;
+    int count;
+    int tag;
+    int context;
+    int received;
+    int collective;
+    bool doomed;
+    bool deadlocked;
+} wait_state_t;
+
+static pthread_mutex_t wait_mutex;
+static wait_state_t wait_state;
+static int wait_epochs;
+static int probe_rounds;
+// Collectives entered, blocking or nonblocking, which all processes enter in the same order.
+static int collectives_entered;
+// Per peer, under deadlock_mutex: user messages sent to it, and the number of the last one of every
+// (count, tag, context), also under MIMPI_ANY_TAG for positive tags. The ledger has LEDGER_SLOTS entries
+// per peer; one pushed out by a colliding message leaves its number in evicted_sequence.
+static int* sent_count;
+static sent_entry_t* sent_ledger;
+static int* evicted_sequence;
+// Per peer, under queue_mutex: user messages received from it.
+static int* received_count;
+// Per peer, under wait_mutex: its wait during which it sent us a probe we dropped, or -1.
+static int* waiter_epoch;
+// Per initiator, under wait_mutex: the last of its probes we forwarded, during which of our waits, and who sent it.
+static int* forwarded_round;
+static int* forwarded_epoch;
+static int* forwarded_from;
+// Shared by the processes of a single host, or NULL when probes are used.
+static wait_slot_t* wait_table;
+static atomic_int* sent_table;
+
+typedef struct {
+    int epoch;
+    int kind;
+    int source;
+    int received;
+    int collective;
+} wait_view_t;
+
+static MIMPI_Retcode send_context_message(void const *data, int count, int destination, int tag, int context);
+
+static bool wait_blocked() {
+    return wait_state.kind != WAIT_NONE && !wait_state.doomed && !wait_state.deadlocked;
+}
+
+static int queue_control(outgoing_t* out, int n, int destination, control_t const* message) {
+    out[n].destination = destination;
+    out[n].message = *message;
+    return n + 1;
+}
+
+static void describe_wait(control_t* message) {
+    message->sender_epoch = wait_state.epoch;
+    message->waiting = wait_state.kind;
+    message->received = wait_state.kind == WAIT_RECV ? wait_state.received : wait_state.collective;
+    message->count = wait_state.count;
+    message->tag = wait_state.tag;
+    message->context = wait_state.context;
+}
+
+static int start_probe(outgoing_t* out, int n, int destination) {
+    control_t probe = {.kind = CONTROL_PROBE, .initiator = rank, .epoch = wait_state.epoch, .round = ++probe_rounds};
+    describe_wait(&probe);
+    return queue_control(out, n, destination, &probe);
+}
+
+static int nudge_waiters(outgoing_t* out, int n) {
+    for (int i = 0; i < size; ++i) {
+        if (i != rank && waiter_epoch[i] >= 0) {
+            control_t nudge = {.kind = CONTROL_NUDGE, .initiator = i, .epoch = waiter_epoch[i]};
+            n = queue_control(out, n, i, &nudge);
+            waiter_epoch[i] = -1;
+        }
+    }
+    return n;
+}
+
+static sent_entry_t* ledger_slot(int peer, int count, int tag, int context) {
+    unsigned hash = (unsigned)count * 2654435761u ^ (unsigned)tag * 40503u ^ (unsigned)context * 2246822519u;
+    return &sent_ledger[peer * LEDGER_SLOTS + hash % LEDGER_SLOTS];
+}
+
+static void ledger_note(int peer, int count, int tag, int context, int sequence) {
+    sent_entry_t* slot = ledger_slot(peer, count, tag, context);
+    if (slot->sequence != 0 && (slot->count != count || slot->tag != tag || slot->context != context)) {
+        evicted_sequence[peer] = max(evicted_sequence[peer], slot->sequence);
+    }
+    slot->count = count;
+    slot->tag = tag;
+    slot->context = context;
+    slot->sequence = sequence;
+}
+
+static int ledger_last(int peer, int count, int tag, int context) {
+    sent_entry_t* slot = ledger_slot(peer, count, tag, context);
+    if (slot->sequence != 0 && slot->count == count && slot->tag == tag && slot->context == context) {
+        return slot->sequence;
+    }
+    return 0;
+}
+
+// Whether the sender still waits for us: it hasn't reached our collective, or nothing we sent to it since it
+// blocked can end its receive. If that can't be told, because the ledger has forgotten a message that hasn't
+// arrived, the edge is taken as broken: a deadlock may go unnoticed, but none is reported falsely.
+static bool edge_holds(int from, control_t const* message) {
+    if (message->waiting == WAIT_COLLECTIVE) {
+        return collectives_entered < message->received;
+    }
+    ASSERT_ZERO(pthread_mutex_lock(&deadlock_mutex[from]));
+    bool holds = ledger_last(from, message->count, message->tag, message->context) <= message->received
+        && evicted_sequence[from] <= message->received;
+    ASSERT_ZERO(pthread_mutex_unlock(&deadlock_mutex[from]));
+    return holds;
+}
+
+static bool on_probe_path(control_t const* message) {
+    return wait_state.kind != WAIT_NONE && forwarded_round[message->initiator] == message->round
+        && forwarded_epoch[message->initiator] == wait_state.epoch;
+}
+
+// Ends our wait after a released cycle: a receive returns, a collective goes on waiting and probing.
+static int release_wait(outgoing_t* out, int n, int* wake) {
+    if (wait_state.kind == WAIT_RECV) {
+        wait_state.deadlocked = true;
+        *wake = wait_state.source;
+        return n;
+    }
+    wait_state.doomed = false;
+    return nudge_waiters(out, n);
+}
+
+static int handle_probe(outgoing_t* out, int n, int from, control_t* probe) {
+    if (!wait_blocked()) {
+        waiter_epoch[from] = probe->sender_epoch;
+        return n;
+    }
+    if (!edge_holds(from, probe)) {
+        return n;
+    }
+    int initiator = probe->initiator;
+    if (initiator == rank) {
+        if (probe->epoch != wait_state.epoch) {
+            return n;
+        }
+        wait_state.doomed = true;
+        forwarded_round[rank] = probe->round;
+        forwarded_epoch[rank] = wait_state.epoch;
+        forwarded_from[rank] = from;
+        control_t doom = {.kind = CONTROL_DOOM, .initiator = rank, .round = probe->round};
+        return queue_control(out, n, from, &doom);
+    }
+    if (forwarded_round[initiator] == probe->round && forwarded_epoch[initiator] == wait_state.epoch) {
+        return n;
+    }
+    forwarded_round[initiator] = probe->round;
+    forwarded_epoch[initiator] = wait_state.epoch;
+    forwarded_from[initiator] = from;
+    describe_wait(probe);
+    if (wait_state.kind == WAIT_RECV) {
+        return queue_control(out, n, wait_state.source, probe);
+    }
+    for (int i = 0; i < size; ++i) {
+        if (i != rank) {
+            n = queue_control(out, n, i, probe);
+        }
+    }
+    return n;
+}
+
+static int handle_control(outgoing_t* out, int from, control_t* message, int* wake) {
+    int n = 0;
+    int initiator = message->initiator;
+    switch (message->kind) {
+        case CONTROL_PROBE:
+            n = handle_probe(out, n, from, message);
+            break;
+        case CONTROL_NUDGE:
+            if (wait_blocked() && message->epoch == wait_state.epoch) {
+                n = start_probe(out, n, wait_state.kind == WAIT_RECV ? wait_state.source : from);
+            }
+            break;
+        case CONTROL_DOOM:
+            if (!on_probe_path(message)) {
+                break;
+            }
+            if (initiator == rank) {
+                // Everyone in the cycle is doomed now.
+                control_t release = {.kind = CONTROL_RELEASE, .initiator = rank, .round = message->round};
+                n = queue_control(out, n, forwarded_from[rank], &release);
+                n = release_wait(out, n, wake);
+            } else {
+                wait_state.doomed = true;
+                n = queue_control(out, n, forwarded_from[initiator], message);
+            }
+            break;
+        case CONTROL_RELEASE:
+            if (!on_probe_path(message) || initiator == rank) {
+                break;
+            }
+            if (forwarded_from[initiator] != initiator) {
+                n = queue_control(out, n, forwarded_from[initiator], message);
+            }
+            n = release_wait(out, n, wake);
+            break;
+    }
+    return n;
+}
+
+static void send_controls(outgoing_t* out, int n) {
+    add_stat(&stats.deadlock_messages, n);
+    for (int i = 0; i < n; ++i) {
+        // Processes that have finished can't be in a cycle anymore.
+        send_context_message(&out[i].message, sizeof(control_t), out[i].destination, DEADLOCK_TAG, WORLD_CONTEXT);
+    }
+}
+
+static void wake_receive(int source) {
+    if (source >= 0) {
+        ASSERT_ZERO(pthread_mutex_lock(&queue_mutex[source]));
+        pthread_cond_broadcast(&queue_cond[source]);
+        ASSERT_ZERO(pthread_mutex_unlock(&queue_mutex[source]));
+    }
+}
+
+static void receive_control(int from, control_t* message) {
+    outgoing_t* out = malloc(size * sizeof(outgoing_t));
+    int wake = -1;
+    int n = 0;
+    ASSERT_ZERO(pthread_mutex_lock(&wait_mutex));
+    if (wait_table == NULL) {
+        n = handle_control(out, from, message, &wake);
+    } else if (message->kind == CONTROL_RELEASE && wait_state.kind == WAIT_RECV) {
+        // The releasing process has marked our wait in the table already.
+        wake = wait_state.source;
+    }
+    ASSERT_ZERO(pthread_mutex_unlock(&wait_mutex));
+    send_controls(out, n);
+    wake_receive(wake);
+    free(out);
+}
+
+static bool still_blocked(int process, wait_view_t const* view) {
+    wait_slot_t* slot = &wait_table[process];
+    return atomic_load(&slot->epoch) == view->epoch && atomic_load(&slot->kind) != WAIT_NONE
+        && atomic_load(&slot->doomed) != view->epoch;
+}
+
+// Reads the wait of a process from the table, if it is blocked and hasn't been found in a cycle already.
+static bool read_wait(int process, wait_view_t* view) {
+    wait_slot_t* slot = &wait_table[process];
+    view->epoch = atomic_load(&slot->epoch);
+    if (view->epoch % 2 == 1) {
+        return false;
+    }
+    view->kind = atomic_load(&slot->kind);
+    view->source = atomic_load(&slot->source);
+    view->received = atomic_load(&slot->received);
+    view->collective = atomic_load(&slot->collective);
+    return view->kind != WAIT_NONE && still_blocked(process, view);
+}
+
+// Whether a blocked process waits for another one, blocked as well: all messages the other has sent to it have
+// arrived without ending its receive, or the other hasn't entered its collective, nor started it as a nonblocking
+// one that its progress thread will run. As the other is read before
+// its messages are counted, none it sent before blocking can be missed.
+static bool waits_for(int from, wait_view_t const* from_view, int to, wait_view_t const* to_view) {
+    if (from_view->kind == WAIT_RECV) {
+        return from_view->source == to && atomic_load(&sent_table[to * size + from]) <= from_view->received;
+    }
+    return to_view->collective < from_view->collective;
+}
+
+// Searches the table breadth first for a cycle of waits through us. Processes on it are checked again to still
+// wait the same way, so that all of them were blocked at once. All are doomed before those in MIMPI_Recv are
+// released and woken, so that no other search can see one of them blocked after another has left.
+static void search_table() {
+    add_stat(&stats.deadlock_searches, 1);
+    wait_view_t* views = malloc(size * sizeof(wait_view_t));
+    int* parent = malloc(size * sizeof(int));
+    int* order = malloc(size * sizeof(int));
+    for (int i = 0; i < size; ++i) {
+        parent[i] = -1;
+    }
+    int last = -1;
+    int head = 0;
+    int tail = 0;
+    if (read_wait(rank, &views[rank])) {
+        parent[rank] = rank;
+        order[tail++] = rank;
+    }
+    while (head < tail && last < 0) {
+        int u = order[head++];
+        for (int v = 0; v < size && last < 0; ++v) {
+            if (v == u || (views[u].kind == WAIT_RECV && v != views[u].source)) {
+                continue;
+            }
+            if (v == rank) {
+                if (waits_for(u, &views[u], rank, &views[rank])) {
+                    last = u;
+                }
+            } else if (parent[v] < 0 && read_wait(v, &views[v]) && waits_for(u, &views[u], v, &views[v])) {
+                parent[v] = u;
+                order[tail++] = v;
+            }
+        }
+    }
+    // The cycle, from us back along the search.
+    int members = 0;
+    if (last >= 0) {
+        for (int u = last; u != rank; u = parent[u]) {
+            order[members++] = u;
+        }
+        order[members++] = rank;
+    }
+    bool cycle = members > 0;
+    for (int i = 0; i < members && cycle; ++i) {
+        cycle = still_blocked(order[i], &views[order[i]]);
+    }
+    if (cycle) {
+        for (int i = 0; i < members; ++i) {
+            atomic_store(&wait_table[order[i]].doomed, views[order[i]].epoch);
+        }
+        for (int i = 0; i < members; ++i) {
+            int u = order[i];
+            if (views[u].kind == WAIT_COLLECTIVE) {
+                // Collectives keep waiting, and can be part of another cycle.
+                atomic_store(&wait_table[u].doomed, 0);
+                continue;
+            }
+            atomic_store(&wait_table[u].released, views[u].epoch);
+            if (u != rank) {
+                control_t release = {.kind = CONTROL_RELEASE, .initiator = rank, .epoch = views[u].epoch};
+                add_stat(&stats.deadlock_messages, 1);
+                send_context_message(&release, sizeof(control_t), u, DEADLOCK_TAG, WORLD_CONTEXT);
+            }
+        }
+    }
+    free(views);
+    free(parent);
+    free(order);
+}
+
+static void publish_wait() {
+    wait_slot_t* slot = &wait_table[rank];
+    atomic_store(&slot->epoch, 2 * wait_state.epoch - 1);
+    atomic_store(&slot->kind, wait_state.kind);
+    atomic_store(&slot->source, wait_state.source);
+    atomic_store(&slot->received, wait_state.received);
+    atomic_store(&slot->collective, collectives_entered);
+    atomic_store(&slot->epoch, 2 * wait_state.epoch);
+}
+
+static void begin_wait(wait_kind_t kind, int source, int count, int tag, int context, int received) {
+    outgoing_t* out = malloc((size + 1) * sizeof(outgoing_t));
+    ASSERT_ZERO(pthread_mutex_lock(&wait_mutex));
+    wait_state.kind = kind;
+    wait_state.epoch = ++wait_epochs;
+    wait_state.source = source;
+    wait_state.count = count;
+    wait_state.tag = tag;
+    wait_state.context = context;
+    wait_state.received = received;
+    wait_state.doomed = false;
+    wait_state.deadlocked = false;
+    int n = 0;
+    if (kind == WAIT_COLLECTIVE) {
+        wait_state.collective = ++collectives_entered;
+    }
+    if (wait_table != NULL) {
+        publish_wait();
+    } else {
+        if (kind == WAIT_RECV) {
+            n = start_probe(out, n, source);
+        }
+        n = nudge_waiters(out, n);
+    }
+    ASSERT_ZERO(pthread_mutex_unlock(&wait_mutex));
+    if (wait_table != NULL) {
+        search_table();
+    }
+    send_controls(out, n);
+    free(out);
+}
+
+// Publishes that the messages which arrived during a receive didn't end it; only the table needs to know.
+static void update_wait(int received) {
+    if (wait_table != NULL && atomic_load(&wait_table[rank].received) != received) {
+        atomic_store(&wait_table[rank].received, received);
+        search_table();
+    }
+}
+
+static void end_wait() {
+    ASSERT_ZERO(pthread_mutex_lock(&wait_mutex));
+    wait_state.kind = WAIT_NONE;
+    if (wait_table != NULL) {
+        atomic_store(&wait_table[rank].kind, WAIT_NONE);
+    }
+    ASSERT_ZERO(pthread_mutex_unlock(&wait_mutex));
+}
+
+static bool wait_deadlocked() {
+    ASSERT_ZERO(pthread_mutex_lock(&wait_mutex));
+    bool deadlocked = wait_state.deadlocked;
+    if (wait_table != NULL) {
+        deadlocked = atomic_load(&wait_table[rank].released) == 2 * wait_state.epoch;
+    }
+    ASSERT_ZERO(pthread_mutex_unlock(&wait_mutex));
+    return deadlocked;
+}
+
+static bool packet_peer(int peer) {
+    return packet && host_of(peer) == host_of(rank);
+}
+
+static void mark_finished(int from) {
+    ASSERT_ZERO(pthread_mutex_lock(&queue_mutex[from]));
+    finished[from] = true;
+    pthread_cond_broadcast(&queue_cond[from]);
+    ASSERT_ZERO(pthread_mutex_unlock(&queue_mutex[from]));
+}
+
+// Queues a message received from a peer, unless it is meant for the deadlock detector.
+static void deliver(int from, void* data, int count, int tag, int context) {
+    add_stat(&peer_stats[from].messages_received, 1);
+    add_stat(&peer_stats[from].bytes_received, count);
+    if (tag == DEADLOCK_TAG) {
+        if (count == sizeof(control_t)) {
+            receive_control(from, data);
+        }
+        free(data);
+        return;
+    }
+    ASSERT_ZERO(pthread_mutex_lock(&queue_mutex[from]));
+    if (tag >= 0) {
+        received_count[from]++;
+    }
+    add_node(queues[from], data, count, tag, context);
+    if (tracing) {
+        trace_event('I', "enqueue", from, tag, count);
+    }
+    peer_stats[from].queue_depth++;
+    peer_stats[from].queue_high_water = max(peer_stats[from].queue_high_water, peer_stats[from].queue_depth);
+    ASSERT_ZERO(pthread_mutex_unlock(&queue_mutex[from]));
+    pthread_cond_broadcast(&queue_cond[from]);
+}
+
+// Every read returns a whole packet, so there is no framing to rebuild beyond joining fragments.
+// Waits for the next packet and returns its length without taking it, or 0 once the peer has finished.
+// Reads are charged for every 512 bytes they ask for (CHANNELS_READ_DELAY), so a packet is then read
+// with exactly its length rather than with room for the largest one.
+static int next_packet_length(int read_fd) {
+    int length;
+    while ((length = recv(read_fd, NULL, 0, MSG_PEEK | MSG_TRUNC)) == -1 && errno == EINTR) {
+    }
+    if (length == -1 && errno == ECONNRESET) {
+        return 0;
+    }
+    ASSERT_SYS_OK(length);
+    return min(length, PACKET_SIZE);
+}
+
+static void packet_receiver(int from, int read_fd) {
+    void* first = malloc(PACKET_SIZE);
+    while (true) {
+        int bytes_read = next_packet_length(read_fd);
+        if (bytes_read == 0) {
+            break;
+        }
+        ASSERT_SYS_OK(bytes_read = recv_fn(read_fd, first, bytes_read));
+        if (bytes_read == 0) {
+            break;
+        }
+        if (bytes_read < (int)sizeof(metadata_t)) {
+            fatal("Truncated packet from process %d", from);
+        }
+        metadata_t* metadata = first;
+        int count = metadata->count;
+        int received = bytes_read - sizeof(metadata_t);
+        void* read_data = malloc(count);
+        memcpy(read_data, first + sizeof(metadata_t), received);
+        while (received < count) {
+            ASSERT_SYS_OK(bytes_read = recv_fn(read_fd, read_data + received, min(PACKET_SIZE, count - received)));
+            if (bytes_read == 0) {
+                break;
+            }
+            received += bytes_read;
+        }
+        if (received < count) {
+            free(read_data);
+            break;
+        }
+        deliver(from, read_data, count, metadata->tag, metadata->context);
+    }
+    free(first);
+    mark_finished(from);
+}
+
+// Reads from a byte stream in chunks of up to STAGING_SIZE and takes every complete message out of them,
+// so a burst of small messages costs a read for several of them. Payloads of at least STAGING_SIZE bytes
+// that haven't arrived yet are read directly into the message, a block at a time.
+static void stream_receiver(int from, int read_fd) {
+    char* staging = malloc(STAGING_SIZE);
+    int start = 0;
+    int end = 0;
+    while (true) {
+        int bytes_read;
+        if (end - start < (int)sizeof(metadata_t)) {
+            memmove(staging, staging + start, end - start);
+            end -= start;
+            start = 0;
+            while (end < (int)sizeof(metadata_t)) {
+                ASSERT_SYS_OK(bytes_read = recv_fn(read_fd, staging + end, STAGING_SIZE - end));
+                if (bytes_read == 0) {
+                    free(staging);
+                    mark_finished(from);
+                    return;
+                }
+                end += bytes_read;
+            }
+        }
+        metadata_t metadata;
+        memcpy(&metadata, staging + start, sizeof(metadata_t));
+        start += sizeof(metadata_t);
+        int count = metadata.count;
+        void* read_data = malloc(count);
+        int received = min(count, end - start);
+        memcpy(read_data, staging + start, received);
+        start += received;
+
+        while (received < count) {
+            int left = count - received;
+            if (left >= STAGING_SIZE) {
+                ASSERT_SYS_OK(bytes_read = recv_fn(read_fd, read_data + received, STAGING_SIZE));
+            } else {
+                ASSERT_SYS_OK(bytes_read = recv_fn(read_fd, staging, STAGING_SIZE));
+                start = min(left, bytes_read);
+                end = bytes_read;
+                memcpy(read_data + received, staging, start);
+                bytes_read = start;
+            }
+            if (bytes_read == 0) {
+                free(read_data);
+                free(staging);
+                mark_finished(from);
+                return;
+            }
+            received += bytes_read;
+        }
+        deliver(from, read_data, count, metadata.tag, metadata.context);
+    }
+}
+
+static void* worker_receiver(void *data) {
+    int from = *(int*)data;
+    free(data);
+    trace_thread = 1 + from;
+    int read_fd = determine_read(rank, from);
+    if (packet_peer(from)) {
+        packet_receiver(from, read_fd);
+    } else {
+        stream_receiver(from, read_fd);
+    }
+    return NULL;
+}
+
+static void start_receiver(int peer) {
+    pthread_attr_t attr;
+    ASSERT_ZERO(pthread_attr_init(&attr));
+    ASSERT_ZERO(pthread_attr_setstacksize(&attr, RECEIVER_STACK_SIZE));
+    int* num = malloc(sizeof(int));
+    *num = peer;
+    ASSERT_ZERO(pthread_create(&threads[peer], &attr, worker_receiver, num));
+    ASSERT_ZERO(pthread_attr_destroy(&attr));
+}
+
+// Runs until the broker closes our socket, after MIMPI_Finalize has shut it down.
+static void* worker_connector(void *data) {
+    (void)data;
+    broker_message_t message;
+    int fds[2];
+    while (true) {
+        int ret;
+        ASSERT_SYS_OK(ret = broker_recv(determine_broker(), &message, fds));
+        if (ret == 0) {
+            return NULL;
+        }
+        int peer = message.peer;
+        if (message.kind == MIMPI_Broker_Connect) {
+            ASSERT_SYS_OK(dup2(fds[0], determine_read(rank, peer)));
+            ASSERT_SYS_OK(dup2(fds[1], determine_write(rank, peer)));
+            ASSERT_SYS_OK(close(fds[0]));
+            ASSERT_SYS_OK(close(fds[1]));
+            start_receiver(peer);
+            ASSERT_ZERO(pthread_mutex_lock(&connect_mutex));
+            connect_state[peer] = PEER_CONNECTED;
+            pthread_cond_broadcast(&connect_cond);
+            ASSERT_ZERO(pthread_mutex_unlock(&connect_mutex));
+            continue;
+        }
+        ASSERT_ZERO(pthread_mutex_lock(&connect_mutex));
+        // A connected peer's receiver learns it has finished after reading all of its messages.
+        bool gone = connect_state[peer] != PEER_CONNECTED;
+        if (gone) {
+            connect_state[peer] = PEER_GONE;
+        }
+        pthread_cond_broadcast(&connect_cond);
+        ASSERT_ZERO(pthread_mutex_unlock(&connect_mutex));
+        // Receives may wait for the peer while holding its queue's mutex and asking for a connection.
+        if (gone) {
+            ASSERT_ZERO(pthread_mutex_lock(&queue_mutex[peer]));
+            finished[peer] = true;
+            pthread_cond_broadcast(&queue_cond[peer]);
+            ASSERT_ZERO(pthread_mutex_unlock(&queue_mutex[peer]));
+        }
+    }
+}
+
+static MIMPI_Retcode connect_peer(int peer) {
+    ASSERT_ZERO(pthread_mutex_lock(&connect_mutex));
+    if (connect_state[peer] == PEER_UNCONNECTED) {
+        broker_message_t message = {MIMPI_Broker_Connect, peer};
+        ASSERT_SYS_OK(broker_send(determine_broker(), &message, NULL, 0));
+        connect_state[peer] = PEER_REQUESTED;
+    }
+    while (connect_state[peer] == PEER_REQUESTED) {
+        pthread_cond_wait(&connect_cond, &connect_mutex);
+    }
+    MIMPI_Retcode ret = connect_state[peer] == PEER_CONNECTED ? MIMPI_SUCCESS : MIMPI_ERROR_REMOTE_FINISHED;
+    ASSERT_ZERO(pthread_mutex_unlock(&connect_mutex));
+    return ret;
+}
+
+static bool peer_connected(int peer) {
+    return !lazy || connect_state[peer] == PEER_CONNECTED;
+}
+
+// Sets up everything else once the world and tracing are known.
+static void init_call() {
+    group_init(size);
+    const char* barrier = getenv("MIMPI_BARRIER");
+    if (barrier == NULL || strcmp(barrier, "tree") == 0) {
+        barrier_backend = BARRIER_TREE;
+    } else if (strcmp(barrier, "dissemination") == 0) {
+        barrier_backend = BARRIER_DISSEMINATION;
+    } else if (strcmp(barrier, "shm") == 0) {
+        barrier_backend = BARRIER_SHARED;
+        shared_barrier = mmap(NULL, shared_barrier_size(size), PROT_READ | PROT_WRITE, MAP_SHARED, determine_shared(), 0);
+        if (shared_barrier == MAP_FAILED) {
+            syserr("mmap of shared barrier failed");
+        }
+        ASSERT_SYS_OK(close(determine_shared()));
+        local_sense = 0;
+    } else {
+        fatal("Unknown MIMPI_BARRIER: %s", barrier);
+    }
+    collectives_head = NULL;
+    collectives_tail = NULL;
+    progress_running = false;
+    progress_stopping = false;
+    ASSERT_ZERO(pthread_mutex_init(&collectives_mutex, NULL));
+    cond_init(&collectives_cond);
+    world_comm.context = WORLD_CONTEXT;
+    world_comm.size = size;
+    world_comm.rank = rank;
+    world_comm.ranks = malloc(size * sizeof(int));
+    for (int i = 0; i < size; ++i) {
+        world_comm.ranks[i] = i;
+    }
+    next_context = WORLD_CONTEXT + 1;
+    deadlock_mutex = malloc(size * sizeof(pthread_mutex_t));
+    peer_stats = calloc(size, sizeof(peer_stats_t));
+    finished = malloc(size * sizeof(bool));
+    queues = malloc(size * sizeof(queue_t*));
+    threads = malloc(size * sizeof(pthread_t));
+    queue_mutex = malloc(size * sizeof(pthread_mutex_t));
+    queue_cond = malloc(size * sizeof(pthread_cond_t));
+    send_mutex = malloc(size * sizeof(pthread_mutex_t));
+    sent_count = malloc(size * sizeof(int));
+    evicted_sequence = malloc(size * sizeof(int));
+    sent_ledger = deadlock_detection ? calloc(size * LEDGER_SLOTS, sizeof(sent_entry_t)) : NULL;
+    received_count = malloc(size * sizeof(int));
+    waiter_epoch = malloc(size * sizeof(int));
+    forwarded_round = malloc(size * sizeof(int));
+    forwarded_epoch = malloc(size * sizeof(int));
+    forwarded_from = malloc(size * sizeof(int));
+    for (int i = 0; i < size; ++i) {
+        sent_count[i] = 0;
+        evicted_sequence[i] = 0;
+        received_count[i] = 0;
+        waiter_epoch[i] = -1;
+        forwarded_round[i] = -1;
+        forwarded_epoch[i] = -1;
+        forwarded_from[i] = -1;
+    }
+    wait_state.kind = WAIT_NONE;
+    wait_epochs = 0;
+    probe_rounds = 0;
+    collectives_entered = 0;
+    ASSERT_ZERO(pthread_mutex_init(&wait_mutex, NULL));
+    wait_table = NULL;
+    sent_table = NULL;
+    if (host_count() == 1) {
+        if (deadlock_detection) {
+            wait_table = mmap(NULL, wait_table_size(size), PROT_READ | PROT_WRITE, MAP_SHARED, determine_wait_table(), 0);
+            if (wait_table == MAP_FAILED) {
+                syserr("mmap of wait table failed");
+            }
+            sent_table = (atomic_int*)(wait_table + size);
+        }
+        ASSERT_SYS_OK(close(determine_wait_table()));
+    }
+    lazy = lazy_connect();
+    packet = packet_transport();
+    use_uring = packet && uring_io() && uring_init();
+    connect_state = malloc(size * sizeof(int));
+    for (int i = 0; i < size; ++i) {
+        if (i != rank) {
+            finished[i] = false;
+            queues[i] = new_queue();
+            if (deadlock_detection) {
+                ASSERT_ZERO(pthread_mutex_init(&deadlock_mutex[i], NULL));
+            }
+            ASSERT_ZERO(pthread_mutex_init(&queue_mutex[i], NULL));
+            cond_init(&queue_cond[i]);
+            ASSERT_ZERO(pthread_mutex_init(&send_mutex[i], NULL));
+            connect_state[i] = PEER_UNCONNECTED;
+            if (!lazy) {
+                start_receiver(i);
+            }
+        }
+
+    }
+    if (lazy) {
+        ASSERT_ZERO(pthread_mutex_init(&connect_mutex, NULL));
+        ASSERT_ZERO(pthread_cond_init(&connect_cond, NULL));
+        ASSERT_ZERO(pthread_create(&connector, NULL, worker_connector, NULL));
+    }
+}
+
+void PMIMPI_Init(bool enable_deadlock_detection) {
+    channels_init();
+    deadlock_detection = enable_deadlock_detection;
+    ASSERT_SYS_OK(size = strtol(getenv("MIMPI_SIZE"), NULL, 0));
+    ASSERT_SYS_OK(rank = strtol(getenv("MIMPI_RANK"), NULL, 0));
+    char const* trace = getenv("MIMPI_TRACE");
+    tracing = trace != NULL && *trace != '\0';
+    if (tracing) {
+        trace_events = malloc(TRACE_EVENTS * sizeof(trace_event_t));
+        atomic_store(&trace_next, 0);
+        trace_event('B', "MIMPI_Init", 0, 0, 0);
+        init_call();
+        trace_event('E', "MIMPI_Init", 0, 0, 0);
+        return;
+    }
+    init_call();
+}
+
+// With MIMPI_STATS set to a directory, leaves the counters in its file rank<i>, for mimpirun to merge.
+static void dump_stats() {
+    const char* dir = getenv("MIMPI_STATS");
+    if (dir == NULL || *dir == '\0') {
+        return;
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/rank%d", dir, rank);
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        syserr("Can't write statistics to %s", path);
+    }
+    MIMPI_Stats totals;
+    MIMPI_Peer_stats* peers = malloc(size * sizeof(MIMPI_Peer_stats));
+    PMIMPI_Get_stats(&totals, peers);
+    fprintf(file, "recv_blocked_ns %lld\n", totals.recv_blocked_ns);
+    fprintf(file, "collective_ns %lld\n", totals.collective_ns);
+    fprintf(file, "chunks_sent %lld\n", totals.chunks_sent);
+    fprintf(file, "chunks_received %lld\n", totals.chunks_received);
+    fprintf(file, "write_calls %lld\n", totals.write_calls);
+    fprintf(file, "read_calls %lld\n", totals.read_calls);
+    fprintf(file, "deadlock_messages %lld\n", totals.deadlock_messages);
+    fprintf(file, "deadlock_searches %lld\n", totals.deadlock_searches);
+    for (int i = 0; i < size; ++i) {
+        fprintf(file, "peer %d %lld %lld %lld %lld %d\n", i, peers[i].messages_sent, peers[i].bytes_sent,
+                peers[i].messages_received, peers[i].bytes_received, peers[i].queue_high_water);
+    }
+    free(peers);
+    if (fclose(file) != 0) {
+        syserr("Can't write statistics to %s", path);
+    }
+}
+
+// With MIMPI_LATENCY set, prints percentiles of latencies in microseconds, as a single write, so that the tables
+// of different processes don't interleave.
+static void print_latencies() {
+    const char* enabled = getenv("MIMPI_LATENCY");
+    if (enabled == NULL || *enabled == '\0') {
+        return;
+    }
+    static char const* const names[MIMPI_LATENCY_KINDS] = {
+        [MIMPI_LATENCY_SEND] = "send",
+        [MIMPI_LATENCY_RECV_MATCH] = "recv match",
+        [MIMPI_LATENCY_RECV_COPY] = "recv copy",
+        [MIMPI_LATENCY_BARRIER] = "barrier",
+        [MIMPI_LATENCY_BCAST] = "bcast",
+        [MIMPI_LATENCY_REDUCE] = "reduce",
+    };
+    static double const percentiles[] = {50, 90, 99, 99.9};
+    char title[32];
+    snprintf(title, sizeof(title), "rank %d latency (us)", rank);
+    char table[2048];
+    int length = snprintf(table, sizeof(table), "%-20s %10s %10s %10s %10s %10s\n", title, "calls", "p50", "p90", "p99",
+                          "p99.9");
+    for (int kind = 0; kind < MIMPI_LATENCY_KINDS; ++kind) {
+        long long calls;
+        latency_percentile(kind, 0, &calls);
+        length += snprintf(table + length, sizeof(table) - length, "  %-18s %10lld", names[kind], calls);
+        for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); ++i) {
+            double us = latency_percentile(kind, percentiles[i], NULL) / 1000.0;
+            length += snprintf(table + length, sizeof(table) - length, " %10.1f", us);
+        }
+        length += snprintf(table + length, sizeof(table) - length, "\n");
+    }
+    fputs(table, stderr);
+}
+
+// Leaves the events in the file trace<i> of MIMPI_TRACE, oldest first, after the names of threads that recorded them.
+static void flush_trace() {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/trace%d", getenv("MIMPI_TRACE"), rank);
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        syserr("Can't write trace to %s", path);
+    }
+    unsigned long long end = atomic_load(&trace_next);
+    unsigned long long begin = end > TRACE_EVENTS ? end - TRACE_EVENTS : 0;
+    bool* recorded = calloc(size + 2, sizeof(bool));
+    for (unsigned long long i = begin; i < end; ++i) {
+        recorded[trace_events[i % TRACE_EVENTS].thread] = true;
+    }
+    for (int thread = 0; thread < size + 2; ++thread) {
+        if (!recorded[thread]) {
+            continue;
+        }
+        if (thread == 0) {
+            fprintf(file, "T %d calls\n", thread);
+        } else if (thread <= size) {
+            fprintf(file, "T %d receiver from %d\n", thread, thread - 1);
+        } else {
+            fprintf(file, "T %d progress\n", thread);
+        }
+    }
+    for (unsigned long long i = begin; i < end; ++i) {
+        trace_event_t* event = &trace_events[i % TRACE_EVENTS];
+        fprintf(file, "%c %d %lld %s", event->phase, event->thread, event->time_ns, event->name);
+        if (event->phase == 'I') {
+            fprintf(file, " %d %d %d", event->from, event->tag, event->count);
+        }
+        fprintf(file, "\n");
+    }
+    free(recorded);
+    if (fclose(file) != 0) {
+        syserr("Can't write trace to %s", path);
+    }
+}
+
+void PMIMPI_Finalize() {
+    if (tracing) {
+        trace_event('B', "MIMPI_Finalize", 0, 0, 0);
+    }
+    // Collectives started, but not waited for, are still run to keep the others in step.
+    stop_progress();
+    ASSERT_ZERO(pthread_mutex_destroy(&collectives_mutex));
+    ASSERT_ZERO(pthread_cond_destroy(&collectives_cond));
+
+    if (barrier_backend == BARRIER_SHARED) {
+        atomic_store(&shared_barrier->finished[rank], 1);
+        atomic_fetch_add(&shared_barrier->wake, 1);
+        futex_wake(&shared_barrier->wake);
+        ASSERT_SYS_OK(munmap(shared_barrier, shared_barrier_size(size)));
+    }
+
+    for (int i = 0; i < group_positions(); ++i) {
+        if (group_num(rank, i) >= 0) {
+            ASSERT_SYS_OK(close(determine_gwrite(i)));
+            ASSERT_SYS_OK(close(determine_gread(i)));
+        }
+    }
+    if (lazy) {
+        // Channels granted until the broker learns we've finished still arrive, and are closed below.
+        ASSERT_SYS_OK(shutdown(determine_broker(), SHUT_WR));
+        ASSERT_ZERO(pthread_join(connector, NULL));
+        ASSERT_SYS_OK(close(determine_broker()));
+        ASSERT_ZERO(pthread_mutex_destroy(&connect_mutex));
+        ASSERT_ZERO(pthread_cond_destroy(&connect_cond));
+    }
+    for (int i = 0; i < size; ++i) {
+        if (i != rank && peer_connected(i)) {
+            // A socket is also open as the read end, so closing isn't enough for the peer to see end of file.
+            if (shutdown(determine_write(rank, i), SHUT_WR) == -1 && errno != ENOTSOCK) {
+                ASSERT_SYS_OK(-1);
+            }
+            ASSERT_SYS_OK(close(determine_write(rank, i)));
+        } else if (i != rank) {
+            // Slots of peers never connected still hold mimpirun's placeholders.
+            ASSERT_SYS_OK(close(determine_write(rank, i)));
+            ASSERT_SYS_OK(close(determine_read(rank, i)));
+        }
+    }
+
+    // Receivers are still running, so messages in flight now may be missing from the counters.
+    dump_stats();
+    print_latencies();
+    for (int i = 0; i < size; ++i) {
+        if (i != rank && peer_connected(i)) {
+            ASSERT_ZERO(pthread_join(threads[i], NULL));
+            ASSERT_SYS_OK(close(determine_read(rank, i)));
+        }
+        if (i != rank) {
+            ASSERT_ZERO(pthread_mutex_destroy(&queue_mutex[i]));
+            ASSERT_ZERO(pthread_cond_destroy(&queue_cond[i]));
+            ASSERT_ZERO(pthread_mutex_destroy(&send_mutex[i]));
+            delete_queue(queues[i]);
+            if (deadlock_detection) {
+                ASSERT_ZERO(pthread_mutex_destroy(&deadlock_mutex[i]));
+            }
+        }
+    }
+    free(world_comm.ranks);
+    free(deadlock_mutex);
+    free(finished);
+    free(queues);
+    free(threads);
+    free(queue_mutex);
+    free(queue_cond);
+    free(send_mutex);
+    free(connect_state);
+    free(sent_count);
+    free(evicted_sequence);
+    free(sent_ledger);
+    free(received_count);
+    free(waiter_epoch);
+    free(forwarded_round);
+    free(forwarded_epoch);
+    free(forwarded_from);
+    free(peer_stats);
+    ASSERT_ZERO(pthread_mutex_destroy(&wait_mutex));
+    if (wait_table != NULL) {
+        ASSERT_SYS_OK(munmap(wait_table, wait_table_size(size)));
+    }
+    if (use_uring) {
+        uring_finalize();
+    }
+    if (tracing) {
+        trace_event('E', "MIMPI_Finalize", 0, 0, 0);
+        flush_trace();
+        free(trace_events);
+    }
+    channels_finalize();
+}
+
+MIMPI_Retcode PMIMPI_Get_stats(MIMPI_Stats *out, MIMPI_Peer_stats *peers) {
+    out->recv_blocked_ns = atomic_load_explicit(&stats.recv_blocked_ns, memory_order_relaxed);
+    out->collective_ns = atomic_load_explicit(&stats.collective_ns, memory_order_relaxed);
+    out->chunks_sent = atomic_load_explicit(&stats.chunks_sent, memory_order_relaxed);
+    out->chunks_received = atomic_load_explicit(&stats.chunks_received, memory_order_relaxed);
+    out->write_calls = atomic_load_explicit(&stats.write_calls, memory_order_relaxed);
+    out->read_calls = atomic_load_explicit(&stats.read_calls, memory_order_relaxed);
+    out->deadlock_messages = atomic_load_explicit(&stats.deadlock_messages, memory_order_relaxed);
+    out->deadlock_searches = atomic_load_explicit(&stats.deadlock_searches, memory_order_relaxed);
+    if (peers == NULL) {
+        return MIMPI_SUCCESS;
+    }
+    for (int i = 0; i < size; ++i) {
+        peer_stats_t* peer = &peer_stats[i];
+        peers[i].messages_sent = atomic_load_explicit(&peer->messages_sent, memory_order_relaxed);
+        peers[i].bytes_sent = atomic_load_explicit(&peer->bytes_sent, memory_order_relaxed);
+        peers[i].messages_received = atomic_load_explicit(&peer->messages_received, memory_order_relaxed);
+        peers[i].bytes_received = atomic_load_explicit(&peer->bytes_received, memory_order_relaxed);
+        peers[i].queue_depth = 0;
+        peers[i].queue_high_water = 0;
+        if (i != rank) {
+            ASSERT_ZERO(pthread_mutex_lock(&queue_mutex[i]));
+            peers[i].queue_depth = peer->queue_depth;
+            peers[i].queue_high_water = peer->queue_high_water;
+            ASSERT_ZERO(pthread_mutex_unlock(&queue_mutex[i]));
+        }
+    }
+    return MIMPI_SUCCESS;
+}
+
+MIMPI_Retcode PMIMPI_Get_latency(MIMPI_Latency kind, double percentile, long long *ns, long long *calls) {
+    // Written as a negation, so that a NaN percentile is rejected as well.
+    if (kind < 0 || kind >= MIMPI_LATENCY_KINDS || !(percentile >= 0 && percentile <= 100)) {
+        return MIMPI_ERROR_INVALID_ARGUMENT;
+    }
+    *ns = latency_percentile(kind, percentile, calls);
+    return MIMPI_SUCCESS;
+}
+
+int PMIMPI_World_size() {
+    return size;
+}
+
+int PMIMPI_World_rank() {
+    return rank;
+}
+
+// Sends a message as packets of at most PACKET_SIZE bytes, the first one with the header.
+static MIMPI_Retcode send_packets(int send_fd, void const *data, int count, int destination, int tag, int context) {
+    int first_size = min(count, PACKET_SIZE - (int)sizeof(metadata_t));
+    void* package = malloc(sizeof(metadata_t) + first_size);
+    metadata_t* meta = package;
+    meta->count = count;
+    meta->tag = tag;
+    meta->context = context;
+    memcpy(package + sizeof(metadata_t), data, first_size);
+    packet_batch_t* batch = malloc(sizeof(packet_batch_t));
+    batch->send_fd = send_fd;
+    batch->queued = 0;
+    batch->ret = MIMPI_SUCCESS;
+    ASSERT_ZERO(pthread_mutex_lock(&send_mutex[destination]));
+    batch_packet(batch, package, sizeof(metadata_t) + first_size);
+    int sent = first_size;
+    while (sent < count) {
+        int fragment = min(PACKET_SIZE, count - sent);
+        batch_packet(batch, data + sent, fragment);
+        sent += fragment;
+    }
+    flush_packets(batch);
+    ASSERT_ZERO(pthread_mutex_unlock(&send_mutex[destination]));
+    MIMPI_Retcode ret = batch->ret;
+    free(batch);
+    free(package);
+    return ret;
+}
+
+// Sends a framed message; the header goes out in the same chsend as the beginning of the data.
+static MIMPI_Retcode send_context_message(void const *data, int count, int destination, int tag, int context) {
+    if (lazy && connect_peer(destination) == MIMPI_ERROR_REMOTE_FINISHED) {
+        return MIMPI_ERROR_REMOTE_FINISHED;
+    }
+    add_stat(&peer_stats[destination].messages_sent, 1);
+    add_stat(&peer_stats[destination].bytes_sent, count);
+    int send_fd = determine_write(rank, destination);
+    if (packet_peer(destination)) {
+        return send_packets(send_fd, data, count, destination, tag, context);
+    }
+    int first_size = min(count, 512 - (int)sizeof(metadata_t));
+    void* package = malloc(sizeof(metadata_t) + first_size);
+    metadata_t* meta = package;
+    meta->count = count;
+    meta->tag = tag;
+    meta->context = context;
+    memcpy(package + sizeof(metadata_t), data, first_size);
+    ASSERT_ZERO(pthread_mutex_lock(&send_mutex[destination]));
+    MIMPI_Retcode ret = send_data_fn(send_fd, sizeof(metadata_t) + first_size, package);
+    if (ret == MIMPI_SUCCESS) {
+        ret = send_data_fn(send_fd, count - first_size, (void*)data + first_size);
+    }
+    ASSERT_ZERO(pthread_mutex_unlock(&send_mutex[destination]));
+    free(package);
+    return ret;
+}
+
+static MIMPI_Retcode send_message(void const *data, int count, int destination, int tag) {
+    return send_context_message(data, count, destination, tag, WORLD_CONTEXT);
+}
+
+// Sends a user's message, noting it for deadlock detection.
+// It is counted before it's sent, so that the table never shows a message in flight as received.
+static MIMPI_Retcode send_user_message(void const *data, int count, int destination, int tag, int context) {
+    if (deadlock_detection && tag >= 0) {
+        ASSERT_ZERO(pthread_mutex_lock(&deadlock_mutex[destination]));
+        int sequence = ++sent_count[destination];
+        if (wait_table != NULL) {
+            atomic_store(&sent_table[rank * size + destination], sequence);
+        } else {
+            ledger_note(destination, count, tag, context, sequence);
+            if (tag > 0) {
+                ledger_note(destination, count, MIMPI_ANY_TAG, context, sequence);
+            }
+        }
+        ASSERT_ZERO(pthread_mutex_unlock(&deadlock_mutex[destination]));
+    }
+    return send_context_message(data, count, destination, tag, context);
+}
+
+static MIMPI_Retcode send_call(
+    void const *data,
+    int count,
+    int destination,
+    int tag
+) {
+    if (destination == rank) {
+        return MIMPI_ERROR_ATTEMPTED_SELF_OP;
+    }
+    if (destination >= size) {
+        return MIMPI_ERROR_NO_SUCH_RANK;
+    }
+    long long started = now_ns();
+    return latency_done(MIMPI_LATENCY_SEND, started, send_user_message(data, count, destination, tag, WORLD_CONTEXT));
+}
+
+MIMPI_Retcode PMIMPI_Send(
+    void const *data,
+    int count,
+    int destination,
+    int tag
+) {
+    TRACED("MIMPI_Send", send_call(data, count, destination, tag));
+}
+
+static void count_recv_blocked(long long blocked_since) {
+    if (blocked_since != 0) {
+        add_stat(&stats.recv_blocked_ns, now_ns() - blocked_since);
+    }
+}
+
+static MIMPI_Retcode recv_context_message(void *data, int count, int source, int tag, int context, bool detect_deadlock) {
+    bool done = false;
+    // Only user's receives count as blocked and have their latency recorded, not the ones collectives make.
+    long long blocked_since = 0;
+    long long started = tag >= 0 ? now_ns() : 0;
+
+    ASSERT_ZERO(pthread_mutex_lock(&queue_mutex[source]));
+    node_t* node = queues[source]->head->next;
+    bool first = true;
+    while (!done) {
+        while (node->next != NULL && !done) {
+            if ((node->tag == tag || (node->tag > 0 && tag == MIMPI_ANY_TAG)) && node->count == count
+                && node->context == context) {
+                if (tag >= 0) {
+                    long long matched = now_ns();
+                    record_latency(MIMPI_LATENCY_RECV_MATCH, matched - started);
+                    memcpy(data, node->data, count);
+                    record_latency(MIMPI_LATENCY_RECV_COPY, now_ns() - matched);
+                } else {
+                    memcpy(data, node->data, count);
+                }
+                node = node->next;
+                remove_node(node->prev);
+                peer_stats[source].queue_depth--;
+                done = true;
+            } else {
+                node = node->next;
+            }
+        }
+        if (!done) {
+            if (first && tag >= 0) {
+                blocked_since = now_ns();
+            }
+            if (detect_deadlock) {
+                if (first) {
+                    begin_wait(WAIT_RECV, source, count, tag, context, received_count[source]);
+                } else {
+                    update_wait(received_count[source]);
+                }
+                if (wait_deadlocked()) {
+                    end_wait();
+                    pthread_mutex_unlock(&queue_mutex[source]);
+                    count_recv_blocked(blocked_since);
+                    return MIMPI_ERROR_DEADLOCK_DETECTED;
+                }
+            }
+            if (finished[source]) {
+                if (detect_deadlock) {
+                    end_wait();
+                }
+                pthread_mutex_unlock(&queue_mutex[source]);
+                count_recv_blocked(blocked_since);
+                return MIMPI_ERROR_REMOTE_FINISHED;
+            }
+            if (!cond_wait(&queue_cond[source], &queue_mutex[source])) {
+                if (detect_deadlock) {
+                    end_wait();
+                }
+                pthread_mutex_unlock(&queue_mutex[source]);
+                count_recv_blocked(blocked_since);
+                return MIMPI_ERROR_TIMEOUT;
+            }
+            // The progress thread may have taken messages from this queue in the meantime.
+            node = queues[source]->head->next;
+            first = false;
+        }
+    }
+    if (detect_deadlock && !first) {
+        end_wait();
+    }
+    ASSERT_ZERO(pthread_mutex_unlock(&queue_mutex[source]));
+    count_recv_blocked(blocked_since);
+    return MIMPI_SUCCESS;
+}
+
+static MIMPI_Retcode recv_message(void *data, int count, int source, int tag, bool detect_deadlock) {
+    return recv_context_message(data, count, source, tag, WORLD_CONTEXT, detect_deadlock);
+}
+
+static MIMPI_Retcode recv_call(
+    void *data,
+    int count,
+    int source,
+    int tag
+) {
+    if (source == rank) {
+        return MIMPI_ERROR_ATTEMPTED_SELF_OP;
+    }
+    if (source >= size) {
+        return MIMPI_ERROR_NO_SUCH_RANK;
+    }
+    return recv_message(data, count, source, tag, deadlock_detection);
+}
+
+MIMPI_Retcode PMIMPI_Recv(
+    void *data,
+    int count,
+    int source,
+    int tag
+) {
+    TRACED("MIMPI_Recv", recv_call(data, count, source, tag));
+}
+
+// Synchronises over the point-to-point channels in ceil(log2(size)) rounds: in round k every process
+// signals the one 2^k ranks ahead and waits for the one 2^k ranks behind. The token carries whether
+// anyone has seen a finished process, and every round is completed anyway, so that the news reaches
+// all processes and no token is left behind for the next barrier.
+static MIMPI_Retcode barrier_dissemination() {
+    char remote_finished = 0;
+    for (int distance = 1; distance < size; distance *= 2) {
+        int to = (rank + distance) % size;
+        int from = (rank - distance + size) % size;
+        if (send_message(&remote_finished, 1, to, BARRIER_TAG) == MIMPI_ERROR_REMOTE_FINISHED) {
+            remote_finished = 1;
+        }
+        char received;
+        MIMPI_Retcode ret = recv_message(&received, 1, from, BARRIER_TAG, false);
+        if (ret == MIMPI_ERROR_TIMEOUT) {
+            return ret;
+        }
+        if (ret == MIMPI_ERROR_REMOTE_FINISHED) {
+            remote_finished = 1;
+        } else {
+            remote_finished |= received;
+        }
+    }
+    return remote_finished ? MIMPI_ERROR_REMOTE_FINISHED : MIMPI_SUCCESS;
+}
+
+static bool any_finished() {
+    for (int i = 0; i < size; ++i) {
+        if (atomic_load(&shared_barrier->finished[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Sense-reversing barrier in memory shared by all processes. The last process to arrive resets
+// the counter and flips the global sense; the others spin for a while and then sleep on the futex.
+// Processes that left the MPI block are flagged in finished, which wakes and fails the waiters.
+static MIMPI_Retcode barrier_shared() {
+    local_sense = !local_sense;
+    if (any_finished()) {
+        return MIMPI_ERROR_REMOTE_FINISHED;
+    }
+    if (atomic_fetch_add(&shared_barrier->arrived, 1) == size - 1) {
+        atomic_store(&shared_barrier->arrived, 0);
+        atomic_store(&shared_barrier->sense, local_sense);
+        atomic_fetch_add(&shared_barrier->wake, 1);
+        futex_wake(&shared_barrier->wake);
+        return MIMPI_SUCCESS;
+    }
+    for (int i = 0; i < BARRIER_SPIN; ++i) {
+        if (atomic_load(&shared_barrier->sense) == local_sense) {
+            return MIMPI_SUCCESS;
+        }
+    }
+    while (true) {
+        int wake = atomic_load(&shared_barrier->wake);
+        if (atomic_load(&shared_barrier->sense) == local_sense) {
+            return MIMPI_SUCCESS;
+        }
+        if (any_finished()) {
+            return MIMPI_ERROR_REMOTE_FINISHED;
+        }
+        if (!futex_wait(&shared_barrier->wake, wake)) {
+            return MIMPI_ERROR_TIMEOUT;
+        }
+    }
+}
+
+static MIMPI_Retcode barrier_tree() {
+    int children = group_children(rank);
+    void** data_array = new_children_data(children, 1);
+    void* data = data_array[children];
+    MIMPI_Retcode ret = read_children_fn(1, data_array, NULL, NULL);
+    if (ret != MIMPI_SUCCESS) {
+        delete_children_data(data_array, children);
+        return ret;
+    }
+    if (group_num(rank, MIMPI_Father) >= 0) {
+        if (send_data_fn(determine_gwrite(MIMPI_Father), 1, data)) {
+            delete_children_data(data_array, children);
+            return MIMPI_ERROR_REMOTE_FINISHED;
+        }
+        ret = read_data_fn(determine_gread(MIMPI_Father), 1, data);
+        if (ret != MIMPI_SUCCESS) {
+            delete_children_data(data_array, children);
+            return ret;
+        }
+    }
+    if (send_children_fn(1, data) == MIMPI_ERROR_REMOTE_FINISHED) {
+        delete_children_data(data_array, children);
+        return MIMPI_ERROR_REMOTE_FINISHED;
+    }
+    delete_children_data(data_array, children);
+    return MIMPI_SUCCESS;
+}
+
+static MIMPI_Retcode barrier_any() {
+    if (barrier_backend == BARRIER_DISSEMINATION) {
+        return barrier_dissemination();
+    }
+    if (barrier_backend == BARRIER_SHARED) {
+        return barrier_shared();
+    }
+    return barrier_tree();
+}
+
+static MIMPI_Retcode bcast_tree(void *data, int count, int root) {
+    int children = group_children(rank);
+    // Data travels up from root to the tree's root, and then down to everyone.
+    // Children not on the root's path send their (meaningless) buffers just to synchronise.
+    int root_path = group_subtree_child(rank, root);
+    if (root_path < 0) {
+        root_path = children;
+    }
+    void** data_array = new_children_data(children, count);
+    MIMPI_Retcode ret = read_children_fn(count, data_array, NULL, NULL);
+    if (ret != MIMPI_SUCCESS) {
+        delete_children_data(data_array, children);
+        return ret;
+    }
+
+    void* data_to_send;
+    if (rank == root) {
+        data_to_send = data;
+    } else {
+        data_to_send = data_array[root_path];
+    }
+    if (group_num(rank, MIMPI_Father) >= 0) {
+
+        if (send_data_fn(determine_gwrite(MIMPI_Father), count, data_to_send) == MIMPI_ERROR_REMOTE_FINISHED) {
+            delete_children_data(data_array, children);
+            return MIMPI_ERROR_REMOTE_FINISHED;
+        }
+
+        ret = read_data_fn(determine_gread(MIMPI_Father), count, data_array[root_path]);
+        if (ret != MIMPI_SUCCESS) {
+            delete_children_data(data_array, children);
+            return ret;
+        }
+
+    }
+
+    if (rank != root) {
+        memcpy(data, data_array[root_path], count);
+        data_to_send = data_array[root_path];
+    } else {
+        data_to_send = data;
+    }
+
+    if (send_children_fn(count, data_to_send) == MIMPI_ERROR_REMOTE_FINISHED) {
+        delete_children_data(data_array, children);
+        return MIMPI_ERROR_REMOTE_FINISHED;
+    }
+
+    delete_children_data(data_array, children);
+    return MIMPI_SUCCESS;
+
+}
+
+static MIMPI_Retcode reduce_tree(void const *send_data, void *recv_data, int count, MIMPI_Op op, int root) {
+    int children = group_children(rank);
+    void** data_array = new_children_data(children, count);
+    void* data = data_array[children];
+    memcpy(data, send_data, count);
+    MIMPI_Retcode ret = read_children_fn(count, data_array, data, &op);
+    if (ret != MIMPI_SUCCESS) {
+        delete_children_data(data_array, children);
+        return ret;
+    }
+
+    if (group_num(rank, MIMPI_Father) >= 0) {
+        if (send_data_fn(determine_gwrite(MIMPI_Father), count, data) == MIMPI_ERROR_REMOTE_FINISHED) {
+            delete_children_data(data_array, children);
+            return MIMPI_ERROR_REMOTE_FINISHED;
+        }
+
+        ret = read_data_fn(determine_gread(MIMPI_Father), count, data);
+        if (ret != MIMPI_SUCCESS) {
+            delete_children_data(data_array, children);
+            return ret;
+        }
+    }
+
+    if (rank == root) {
+        memcpy(recv_data, data, count);
+    }
+
+    if (send_children_fn(count, data) == MIMPI_ERROR_REMOTE_FINISHED) {
+        delete_children_data(data_array, children);
+        return MIMPI_ERROR_REMOTE_FINISHED;
+    }
+    delete_children_data(data_array, children);
+    return MIMPI_SUCCESS;
+}
+
+// Blocking collectives synchronise everyone, so the deadlock detector sees their callers wait for all the others.
+static void begin_collective() {
+    if (deadlock_detection) {
+        begin_wait(WAIT_COLLECTIVE, -1, 0, 0, 0, 0);
+    }
+}
+
+static MIMPI_Retcode end_collective(MIMPI_Retcode ret) {
+    if (deadlock_detection) {
+        end_wait();
+    }
+    return ret;
+}
+
+// A process that has started a nonblocking collective will take part in it, so the detector counts it as entered
+// and doesn't take a blocked caller of the same collective to wait for that process.
+static void enter_nonblocking_collective() {
+    if (deadlock_detection) {
+        ASSERT_ZERO(pthread_mutex_lock(&wait_mutex));
+        collectives_entered++;
+        ASSERT_ZERO(pthread_mutex_unlock(&wait_mutex));
+    }
+}
+
+// Started when a blocking collective waits for the nonblocking ones, and counted by collective_done.
+static long long collective_started;
+
+static MIMPI_Retcode collective_done(MIMPI_Retcode ret) {
+    add_stat(&stats.collective_ns, now_ns() - collective_started);
+    return ret;
+}
+
+// Lets nonblocking collectives called before finish first, so that collectives match in the order they were called.
+// Returns false if a timed call's deadline passes first.
+static bool wait_collectives() {
+    collective_started = now_ns();
+    bool in_time = true;
+    ASSERT_ZERO(pthread_mutex_lock(&collectives_mutex));
+    while (collectives_head != NULL && in_time) {
+        in_time = cond_wait(&collectives_cond, &collectives_mutex);
+    }
+    ASSERT_ZERO(pthread_mutex_unlock(&collectives_mutex));
+    return in_time;
+}
+
+static MIMPI_Retcode run_collective(struct mimpi_request* request) {
+    switch (request->kind) {
+        case REQUEST_BARRIER:
+            TRACED("barrier", barrier_any());
+        case REQUEST_BCAST:
+            TRACED("bcast", bcast_tree(request->data, request->count, request->root));
+        case REQUEST_REDUCE:
+            TRACED("reduce", reduce_tree(request->send_data, request->data, request->count, request->op, request->root));
+    }
+    return MIMPI_SUCCESS;
+}
+
+// Runs queued nonblocking collectives one by one until MIMPI_Finalize, which lets it empty the queue first.
+static void* progress_worker(void* data) {
+    (void)data;
+    trace_thread = size + 1;
+    ASSERT_ZERO(pthread_mutex_lock(&collectives_mutex));
+    while (true) {
+        while (collectives_head == NULL && !progress_stopping) {
+            pthread_cond_wait(&collectives_cond, &collectives_mutex);
+        }
+        if (collectives_head == NULL) {
+            break;
+        }
+        struct mimpi_request* request = collectives_head;
+        ASSERT_ZERO(pthread_mutex_unlock(&collectives_mutex));
+        MIMPI_Retcode retcode = run_collective(request);
+        ASSERT_ZERO(pthread_mutex_lock(&collectives_mutex));
+        request->retcode = retcode;
+        request->done = true;
+        collectives_head = request->next;
+        if (collectives_head == NULL) {
+            collectives_tail = NULL;
+        }
+        pthread_cond_broadcast(&collectives_cond);
+    }
+    ASSERT_ZERO(pthread_mutex_unlock(&collectives_mutex));
+    return NULL;
+}
+
+// Queues the request for the progress thread, starting the thread on first use.
+static void start_collective(struct mimpi_request* request, MIMPI_Request* handle) {
+    enter_nonblocking_collective();
+    request->done = false;
+    request->retcode = MIMPI_SUCCESS;
+    request->next = NULL;
+    ASSERT_ZERO(pthread_mutex_lock(&collectives_mutex));
+    if (!progress_running) {
+        ASSERT_ZERO(pthread_create(&progress_thread, NULL, progress_worker, NULL));
+        progress_running = true;
+    }
+    if (collectives_tail == NULL) {
+        collectives_head = request;
+    } else {
+        collectives_tail->next = request;
+    }
+    collectives_tail = request;
+    pthread_cond_broadcast(&collectives_cond);
+    ASSERT_ZERO(pthread_mutex_unlock(&collectives_mutex));
+    *handle = request;
+}
+
+static MIMPI_Retcode barrier_call() {
+    if (!wait_collectives()) {
+        return collective_done(MIMPI_ERROR_TIMEOUT);
+    }
+    begin_collective();
+    return latency_done(MIMPI_LATENCY_BARRIER, collective_started, collective_done(end_collective(barrier_any())));
+}
+
+MIMPI_Retcode PMIMPI_Barrier() {
+    TRACED("MIMPI_Barrier", barrier_call());
+}
+
+static MIMPI_Retcode bcast_call(
+    void *data,
+    int count,
+    int root
+) {
+    if (root >= size) {
+        return MIMPI_ERROR_NO_SUCH_RANK;
+    }
+    if (!wait_collectives()) {
+        return collective_done(MIMPI_ERROR_TIMEOUT);
+    }
+    begin_collective();
+    return latency_done(MIMPI_LATENCY_BCAST, collective_started, collective_done(end_collective(bcast_tree(data, count, root))));
+}
+
+MIMPI_Retcode PMIMPI_Bcast(
+    void *data,
+    int count,
+    int root
+) {
+    TRACED("MIMPI_Bcast", bcast_call(data, count, root));
+}
+
+static MIMPI_Retcode reduce_call(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    MIMPI_Op op,
+    int root
+) {
+    if (root >= size) {
+        return MIMPI_ERROR_NO_SUCH_RANK;
+    }
+    if (!wait_collectives()) {
+        return collective_done(MIMPI_ERROR_TIMEOUT);
+    }
+    begin_collective();
+    return latency_done(MIMPI_LATENCY_REDUCE, collective_started, collective_done(end_collective(reduce_tree(send_data, recv_data, count, op, root))));
+}
+
+MIMPI_Retcode PMIMPI_Reduce(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    MIMPI_Op op,
+    int root
+) {
+    TRACED("MIMPI_Reduce", reduce_call(send_data, recv_data, count, op, root));
+}
+
+// Timed calls run the plain ones with a deadline for this thread, which every wait on the way gives up at.
+static MIMPI_Retcode recv_timeout_call(
+    void *data,
+    int count,
+    int source,
+    int tag,
+    int timeout_ms
+) {
+    struct timespec deadline = deadline_after(timeout_ms);
+    call_deadline = &deadline;
+    MIMPI_Retcode ret = PMIMPI_Recv(data, count, source, tag);
+    call_deadline = NULL;
+    return ret;
+}
+
+MIMPI_Retcode PMIMPI_Recv_timeout(
+    void *data,
+    int count,
+    int source,
+    int tag,
+    int timeout_ms
+) {
+    TRACED("MIMPI_Recv_timeout", recv_timeout_call(data, count, source, tag, timeout_ms));
+}
+
+static MIMPI_Retcode barrier_timeout_call(int timeout_ms) {
+    struct timespec deadline = deadline_after(timeout_ms);
+    call_deadline = &deadline;
+    MIMPI_Retcode ret = PMIMPI_Barrier();
+    call_deadline = NULL;
+    return ret;
+}
+
+MIMPI_Retcode PMIMPI_Barrier_timeout(int timeout_ms) {
+    TRACED("MIMPI_Barrier_timeout", barrier_timeout_call(timeout_ms));
+}
+
+static MIMPI_Retcode bcast_timeout_call(
+    void *data,
+    int count,
+    int root,
+    int timeout_ms
+) {
+    struct timespec deadline = deadline_after(timeout_ms);
+    call_deadline = &deadline;
+    MIMPI_Retcode ret = PMIMPI_Bcast(data, count, root);
+    call_deadline = NULL;
+    return ret;
+}
+
+MIMPI_Retcode PMIMPI_Bcast_timeout(
+    void *data,
+    int count,
+    int root,
+    int timeout_ms
+) {
+    TRACED("MIMPI_Bcast_timeout", bcast_timeout_call(data, count, root, timeout_ms));
+}
+
+static MIMPI_Retcode reduce_timeout_call(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    MIMPI_Op op,
+    int root,
+    int timeout_ms
+) {
+    struct timespec deadline = deadline_after(timeout_ms);
+    call_deadline = &deadline;
+    MIMPI_Retcode ret = PMIMPI_Reduce(send_data, recv_data, count, op, root);
+    call_deadline = NULL;
+    return ret;
+}
+
+MIMPI_Retcode PMIMPI_Reduce_timeout(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    MIMPI_Op op,
+    int root,
+    int timeout_ms
+) {
+    TRACED("MIMPI_Reduce_timeout", reduce_timeout_call(send_data, recv_data, count, op, root, timeout_ms));
+}
+
+static MIMPI_Retcode ibarrier_call(MIMPI_Request *request) {
+    struct mimpi_request* new_request = malloc(sizeof(struct mimpi_request));
+    new_request->kind = REQUEST_BARRIER;
+    start_collective(new_request, request);
+    return MIMPI_SUCCESS;
+}
+
+MIMPI_Retcode PMIMPI_Ibarrier(MIMPI_Request *request) {
+    TRACED("MIMPI_Ibarrier", ibarrier_call(request));
+}
+
+static MIMPI_Retcode ibcast_call(
+    void *data,
+    int count,
+    int root,
+    MIMPI_Request *request
+) {
+    if (root >= size) {
+        *request = NULL;
+        return MIMPI_ERROR_NO_SUCH_RANK;
+    }
+    struct mimpi_request* new_request = malloc(sizeof(struct mimpi_request));
+    new_request->kind = REQUEST_BCAST;
+    new_request->data = data;
+    new_request->count = count;
+    new_request->root = root;
+    start_collective(new_request, request);
+    return MIMPI_SUCCESS;
+}
+
+MIMPI_Retcode PMIMPI_Ibcast(
+    void *data,
+    int count,
+    int root,
+    MIMPI_Request *request
+) {
+    TRACED("MIMPI_Ibcast", ibcast_call(data, count, root, request));
+}
+
+static MIMPI_Retcode ireduce_call(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    MIMPI_Op op,
+    int root,
+    MIMPI_Request *request
+) {
+    if (root >= size) {
+        *request = NULL;
+        return MIMPI_ERROR_NO_SUCH_RANK;
+    }
+    struct mimpi_request* new_request = malloc(sizeof(struct mimpi_request));
+    new_request->kind = REQUEST_REDUCE;
+    new_request->send_data = send_data;
+    new_request->data = recv_data;
+    new_request->count = count;
+    new_request->op = op;
+    new_request->root = root;
+    start_collective(new_request, request);
+    return MIMPI_SUCCESS;
+}
+
+MIMPI_Retcode PMIMPI_Ireduce(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    MIMPI_Op op,
+    int root,
+    MIMPI_Request *request
+) {
+    TRACED("MIMPI_Ireduce", ireduce_call(send_data, recv_data, count, op, root, request));
+}
+
+static MIMPI_Retcode wait_call(MIMPI_Request *request) {
+    if (*request == NULL) {
+        return MIMPI_SUCCESS;
+    }
+    ASSERT_ZERO(pthread_mutex_lock(&collectives_mutex));
+    while (!(*request)->done) {
+        pthread_cond_wait(&collectives_cond, &collectives_mutex);
+    }
+    ASSERT_ZERO(pthread_mutex_unlock(&collectives_mutex));
+    MIMPI_Retcode ret = (*request)->retcode;
+    free(*request);
+    *request = NULL;
+    return ret;
+}
+
+MIMPI_Retcode PMIMPI_Wait(MIMPI_Request *request) {
+    TRACED("MIMPI_Wait", wait_call(request));
+}
+
+static MIMPI_Retcode test_call(MIMPI_Request *request, bool *flag) {
+    if (*request == NULL) {
+        *flag = true;
+        return MIMPI_SUCCESS;
+    }
+    ASSERT_ZERO(pthread_mutex_lock(&collectives_mutex));
+    *flag = (*request)->done;
+    ASSERT_ZERO(pthread_mutex_unlock(&collectives_mutex));
+    if (!*flag) {
+        return MIMPI_SUCCESS;
+    }
+    return PMIMPI_Wait(request);
+}
+
+MIMPI_Retcode PMIMPI_Test(MIMPI_Request *request, bool *flag) {
+    TRACED("MIMPI_Test", test_call(request, flag));
+}
+
+// Gather and Scatter run over point-to-point channels on a binomial tree rooted at root, in ranks relative to it:
+// the subtree of relative rank r holds the consecutive relative ranks from r up to r plus the lowest set bit of r,
+// so blocks of a subtree travel as one message, preceded by another with their sizes.
+static int relative_span(int relative) {
+    int span = relative == 0 ? size : relative & -relative;
+    return min(span, size - relative);
+}
+
+static int real_rank(int relative, int root) {
+    return (relative + root) % size;
+}
+
+static int sum_counts(int const* counts, int members) {
+    int total = 0;
+    for (int i = 0; i < members; ++i) {
+        total += counts[i];
+    }
+    return total;
+}
+
+static MIMPI_Retcode send_blocks(int destination, int members, int const* counts, void const* blocks, int tag) {
+    MIMPI_Retcode ret = send_context_message(counts, members * sizeof(int), destination, tag, WORLD_CONTEXT);
+    if (ret != MIMPI_SUCCESS) {
+        return ret;
+    }
+    return send_context_message(blocks, sum_counts(counts, members), destination, tag, WORLD_CONTEXT);
+}
+
+static MIMPI_Retcode gather_tree(
+    void const *send_data,
+    int send_count,
+    void *recv_data,
+    int const *recv_counts,
+    int const *displs,
+    int root
+) {
+    int relative = (rank - root + size) % size;
+    int* counts = malloc(relative_span(relative) * sizeof(int));
+    void* blocks = malloc(send_count);
+    memcpy(blocks, send_data, send_count);
+    counts[0] = send_count;
+    int members = 1;
+    int bytes = send_count;
+    MIMPI_Retcode ret = MIMPI_SUCCESS;
+    for (int mask = 1; mask < size; mask *= 2) {
+        if (relative & mask) {
+            ret = send_blocks(real_rank(relative - mask, root), members, counts, blocks, GATHER_TAG);
+            break;
+        }
+        if (relative + mask < size) {
+            // Sizes come first, and tell how much room the blocks need.
+            int child = real_rank(relative + mask, root);
+            int child_members = relative_span(relative + mask);
+            ret = recv_context_message(
+                counts + members, child_members * sizeof(int), child, GATHER_TAG, WORLD_CONTEXT, false);
+            if (ret != MIMPI_SUCCESS) {
+                break;
+            }
+            int child_bytes = sum_counts(counts + members, child_members);
+            blocks = realloc(blocks, bytes + child_bytes);
+            ret = recv_context_message(blocks + bytes, child_bytes, child, GATHER_TAG, WORLD_CONTEXT, false);
+            if (ret != MIMPI_SUCCESS) {
+                break;
+            }
+            members += child_members;
+            bytes += child_bytes;
+        }
+    }
+    if (ret == MIMPI_SUCCESS && relative == 0) {
+        int offset = 0;
+        for (int i = 0; i < size; ++i) {
+            int from = real_rank(i, root);
+            memcpy(recv_data + displs[from], blocks + offset, min(counts[i], recv_counts[from]));
+            offset += counts[i];
+        }
+    }
+    free(blocks);
+    free(counts);
+    return ret;
+}
+
+static MIMPI_Retcode scatter_tree(
+    void const *send_data,
+    int const *send_counts,
+    int const *displs,
+    void *recv_data,
+    int recv_count,
+    int root
+) {
+    int relative = (rank - root + size) % size;
+    int members = relative_span(relative);
+    int* counts = malloc(members * sizeof(int));
+    void* blocks = NULL;
+    MIMPI_Retcode ret = MIMPI_SUCCESS;
+    if (relative == 0) {
+        for (int i = 0; i < size; ++i) {
+            counts[i] = send_counts[real_rank(i, root)];
+        }
+        blocks = malloc(sum_counts(counts, size));
+        int offset = 0;
+        for (int i = 0; i < size; ++i) {
+            memcpy(blocks + offset, send_data + displs[real_rank(i, root)], counts[i]);
+            offset += counts[i];
+        }
+    } else {
+        int parent = real_rank(relative - (relative & -relative), root);
+        ret = recv_context_message(counts, members * sizeof(int), parent, SCATTER_TAG, WORLD_CONTEXT, false);
+        if (ret == MIMPI_SUCCESS) {
+            blocks = malloc(sum_counts(counts, members));
+            ret = recv_context_message(
+                blocks, sum_counts(counts, members), parent, SCATTER_TAG, WORLD_CONTEXT, false);
+        }
+    }
+    // Children with the biggest subtrees get their blocks first.
+    int mask = 1;
+    while (mask < members) {
+        mask *= 2;
+    }
+    for (mask /= 2; mask > 0 && ret == MIMPI_SUCCESS; mask /= 2) {
+        if (mask < members) {
+            int offset = sum_counts(counts, mask);
+            ret = send_blocks(real_rank(relative + mask, root), relative_span(relative + mask), counts + mask,
+                              blocks + offset, SCATTER_TAG);
+        }
+    }
+    if (ret == MIMPI_SUCCESS) {
+        memcpy(recv_data, blocks, min(counts[0], recv_count));
+    }
+    free(blocks);
+    free(counts);
+    return ret;
+}
+
+static MIMPI_Retcode gather_call(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    int root
+) {
+    if (root >= size) {
+        return MIMPI_ERROR_NO_SUCH_RANK;
+    }
+    wait_collectives();
+    int counts[size];
+    int displs[size];
+    for (int i = 0; i < size; ++i) {
+        counts[i] = count;
+        displs[i] = i * count;
+    }
+    return collective_done(gather_tree(send_data, count, recv_data, counts, displs, root));
+}
+
+MIMPI_Retcode PMIMPI_Gather(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    int root
+) {
+    TRACED("MIMPI_Gather", gather_call(send_data, recv_data, count, root));
+}
+
+static MIMPI_Retcode gatherv_call(
+    void const *send_data,
+    int send_count,
+    void *recv_data,
+    int const *recv_counts,
+    int const *displs,
+    int root
+) {
+    if (root >= size) {
+        return MIMPI_ERROR_NO_SUCH_RANK;
+    }
+    wait_collectives();
+    return collective_done(gather_tree(send_data, send_count, recv_data, recv_counts, displs, root));
+}
+
+MIMPI_Retcode PMIMPI_Gatherv(
+    void const *send_data,
+    int send_count,
+    void *recv_data,
+    int const *recv_counts,
+    int const *displs,
+    int root
+) {
+    TRACED("MIMPI_Gatherv", gatherv_call(send_data, send_count, recv_data, recv_counts, displs, root));
+}
+
+static MIMPI_Retcode scatter_call(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    int root
+) {
+    if (root >= size) {
+        return MIMPI_ERROR_NO_SUCH_RANK;
+    }
+    wait_collectives();
+    int counts[size];
+    int displs[size];
+    for (int i = 0; i < size; ++i) {
+        counts[i] = count;
+        displs[i] = i * count;
+    }
+    return collective_done(scatter_tree(send_data, counts, displs, recv_data, count, root));
+}
+
+MIMPI_Retcode PMIMPI_Scatter(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    int root
+) {
+    TRACED("MIMPI_Scatter", scatter_call(send_data, recv_data, count, root));
+}
+
+static MIMPI_Retcode scatterv_call(
+    void const *send_data,
+    int const *send_counts,
+    int const *displs,
+    void *recv_data,
+    int recv_count,
+    int root
+) {
+    if (root >= size) {
+        return MIMPI_ERROR_NO_SUCH_RANK;
+    }
+    wait_collectives();
+    return collective_done(scatter_tree(send_data, send_counts, displs, recv_data, recv_count, root));
+}
+
+MIMPI_Retcode PMIMPI_Scatterv(
+    void const *send_data,
+    int const *send_counts,
+    int const *displs,
+    void *recv_data,
+    int recv_count,
+    int root
+) {
+    TRACED("MIMPI_Scatterv", scatterv_call(send_data, send_counts, displs, recv_data, recv_count, root));
+}
+
+// Bruck's algorithm: ceil(log2(size)) rounds, in round k the blocks gathered so far
+// (at most 2^k of them, kept in order starting from this process) go to the process 2^k ranks behind.
+static MIMPI_Retcode allgather_bruck(void const *send_data, void *recv_data, int const *counts, int const *displs) {
+    int offsets[size + 1];
+    offsets[0] = 0;
+    for (int i = 0; i < size; ++i) {
+        offsets[i + 1] = offsets[i] + counts[(rank + i) % size];
+    }
+    void* blocks = malloc(offsets[size]);
+    memcpy(blocks, send_data, counts[rank]);
+    for (int distance = 1; distance < size; distance *= 2) {
+        int blocks_num = min(distance, size - distance);
+        int to = (rank - distance + size) % size;
+        int from = (rank + distance) % size;
+        if (send_message(blocks, offsets[blocks_num], to, ALLGATHER_TAG) == MIMPI_ERROR_REMOTE_FINISHED
+            || recv_message(blocks + offsets[distance], offsets[distance + blocks_num] - offsets[distance],
+                            from, ALLGATHER_TAG, false) == MIMPI_ERROR_REMOTE_FINISHED) {
+            free(blocks);
+            return MIMPI_ERROR_REMOTE_FINISHED;
+        }
+    }
+    for (int i = 0; i < size; ++i) {
+        memcpy(recv_data + displs[(rank + i) % size], blocks + offsets[i], counts[(rank + i) % size]);
+    }
+    free(blocks);
+    return MIMPI_SUCCESS;
+}
+
+// Ring: in step s every process passes on the block it got in step s - 1, so each link
+// carries every block exactly once.
+static MIMPI_Retcode allgather_ring(void const *send_data, void *recv_data, int const *counts, int const *displs) {
+    int next = (rank + 1) % size;
+    int prev = (rank - 1 + size) % size;
+    memcpy(recv_data + displs[rank], send_data, counts[rank]);
+    for (int step = 0; step < size - 1; ++step) {
+        int send_block = (rank - step + size) % size;
+        int recv_block = (rank - step - 1 + size) % size;
+        if (send_message(recv_data + displs[send_block], counts[send_block], next, ALLGATHER_TAG) == MIMPI_ERROR_REMOTE_FINISHED
+            || recv_message(recv_data + displs[recv_block], counts[recv_block], prev, ALLGATHER_TAG, false) == MIMPI_ERROR_REMOTE_FINISHED) {
             return MIMPI_ERROR_REMOTE_FINISHED;
         }
-        //printf("received %d\n" ,*(short*)data_array[root_path]);
+    }
+    return MIMPI_SUCCESS;
+}
 
+static MIMPI_Retcode allgather_p2p(void const *send_data, void *recv_data, int const *counts, int const *displs) {
+    int biggest = 0;
+    for (int i = 0; i < size; ++i) {
+        biggest = max(biggest, counts[i]);
     }
+    if (biggest <= ALLGATHER_BRUCK_LIMIT) {
+        return allgather_bruck(send_data, recv_data, counts, displs);
+    }
+    return allgather_ring(send_data, recv_data, counts, displs);
+}
 
-    if (rank != root) {
-        memcpy(data, data_array[root_path], count);
-        data_to_send = data_array[root_path];
+static MIMPI_Retcode allgather_call(
+    void const *send_data,
+    void *recv_data,
+    int count
+) {
+    wait_collectives();
+    int counts[size];
+    int displs[size];
+    for (int i = 0; i < size; ++i) {
+        counts[i] = count;
+        displs[i] = i * count;
+    }
+    return collective_done(allgather_p2p(send_data, recv_data, counts, displs));
+}
+
+MIMPI_Retcode PMIMPI_Allgather(
+    void const *send_data,
+    void *recv_data,
+    int count
+) {
+    TRACED("MIMPI_Allgather", allgather_call(send_data, recv_data, count));
+}
+
+static MIMPI_Retcode allgatherv_call(
+    void const *send_data,
+    void *recv_data,
+    int const *recv_counts,
+    int const *displs
+) {
+    wait_collectives();
+    return collective_done(allgather_p2p(send_data, recv_data, recv_counts, displs));
+}
+
+MIMPI_Retcode PMIMPI_Allgatherv(
+    void const *send_data,
+    void *recv_data,
+    int const *recv_counts,
+    int const *displs
+) {
+    TRACED("MIMPI_Allgatherv", allgatherv_call(send_data, recv_data, recv_counts, displs));
+}
+
+// Partners in step (from 1 to size - 1) of a pairwise exchange: every step is a perfect matching,
+// so no process gets more than one message at a time. With a power of two processes partners
+// are paired by XOR, otherwise by shifting ranks by step.
+static void exchange_partners(int step, int* to, int* from) {
+    if ((size & (size - 1)) == 0) {
+        *to = rank ^ step;
+        *from = rank ^ step;
     } else {
-        data_to_send = data;
+        *to = (rank + step) % size;
+        *from = (rank - step + size) % size;
     }
+}
 
+// Pairwise exchange: in every step each process sends one block and receives one block.
+static MIMPI_Retcode alltoall_pairwise(
+    void const *send_data,
+    int const *send_counts,
+    int const *send_displs,
+    void *recv_data,
+    int const *recv_counts,
+    int const *recv_displs
+) {
+    memcpy(recv_data + recv_displs[rank], send_data + send_displs[rank], min(send_counts[rank], recv_counts[rank]));
+    for (int step = 1; step < size; ++step) {
+        int to, from;
+        exchange_partners(step, &to, &from);
+        if (send_message(send_data + send_displs[to], send_counts[to], to, ALLTOALL_TAG) == MIMPI_ERROR_REMOTE_FINISHED
+            || recv_message(recv_data + recv_displs[from], recv_counts[from], from, ALLTOALL_TAG, false) == MIMPI_ERROR_REMOTE_FINISHED) {
+            return MIMPI_ERROR_REMOTE_FINISHED;
+        }
+    }
+    return MIMPI_SUCCESS;
+}
 
-    if (group_num(rank, MIMPI_Left) < size) {
-        if (send_data_fn(determine_gwrite(MIMPI_Left), count, data_to_send) == MIMPI_ERROR_REMOTE_FINISHED) {
-            free(data_array[0]);
-            free(data_array[1]);
+// Bruck's algorithm: blocks are rotated so that block i is meant for the process i ranks ahead,
+// and in round k all blocks with bit k of i set move 2^k ranks ahead together in one message.
+// Takes ceil(log2(size)) messages instead of size - 1, at the cost of forwarding blocks.
+static MIMPI_Retcode alltoall_bruck(void const *send_data, void *recv_data, int count) {
+    void* blocks = malloc(size * count);
+    void* package = malloc(size * count);
+    for (int i = 0; i < size; ++i) {
+        memcpy(blocks + i * count, send_data + ((rank + i) % size) * count, count);
+    }
+    for (int distance = 1; distance < size; distance *= 2) {
+        int to = (rank + distance) % size;
+        int from = (rank - distance + size) % size;
+        int package_size = 0;
+        for (int i = 0; i < size; ++i) {
+            if (i & distance) {
+                memcpy(package + package_size, blocks + i * count, count);
+                package_size += count;
+            }
+        }
+        if (send_message(package, package_size, to, ALLTOALL_TAG) == MIMPI_ERROR_REMOTE_FINISHED
+            || recv_message(package, package_size, from, ALLTOALL_TAG, false) == MIMPI_ERROR_REMOTE_FINISHED) {
+            free(package);
+            free(blocks);
             return MIMPI_ERROR_REMOTE_FINISHED;
         }
+        package_size = 0;
+        for (int i = 0; i < size; ++i) {
+            if (i & distance) {
+                memcpy(blocks + i * count, package + package_size, count);
+                package_size += count;
+            }
+        }
+    }
+    // Block i now comes from the process i ranks behind.
+    for (int i = 0; i < size; ++i) {
+        memcpy(recv_data + ((rank - i + size) % size) * count, blocks + i * count, count);
+    }
+    free(package);
+    free(blocks);
+    return MIMPI_SUCCESS;
+}
+
+static MIMPI_Retcode alltoall_call(
+    void const *send_data,
+    void *recv_data,
+    int count
+) {
+    wait_collectives();
+    if (count <= ALLTOALL_BRUCK_LIMIT) {
+        return collective_done(alltoall_bruck(send_data, recv_data, count));
+    }
+    int counts[size];
+    int displs[size];
+    for (int i = 0; i < size; ++i) {
+        counts[i] = count;
+        displs[i] = i * count;
+    }
+    return collective_done(alltoall_pairwise(send_data, counts, displs, recv_data, counts, displs));
+}
+
+MIMPI_Retcode PMIMPI_Alltoall(
+    void const *send_data,
+    void *recv_data,
+    int count
+) {
+    TRACED("MIMPI_Alltoall", alltoall_call(send_data, recv_data, count));
+}
+
+static MIMPI_Retcode alltoallv_call(
+    void const *send_data,
+    int const *send_counts,
+    int const *send_displs,
+    void *recv_data,
+    int const *recv_counts,
+    int const *recv_displs
+) {
+    wait_collectives();
+    return collective_done(alltoall_pairwise(send_data, send_counts, send_displs, recv_data, recv_counts, recv_displs));
+}
+
+MIMPI_Retcode PMIMPI_Alltoallv(
+    void const *send_data,
+    int const *send_counts,
+    int const *send_displs,
+    void *recv_data,
+    int const *recv_counts,
+    int const *recv_displs
+) {
+    TRACED("MIMPI_Alltoallv", alltoallv_call(send_data, send_counts, send_displs, recv_data, recv_counts, recv_displs));
+}
+
+// Pairwise exchange: every process receives only the contributions to its own block,
+// so each reduces 1/size of the data.
+static MIMPI_Retcode reduce_scatter_pairwise(void const *send_data, void *recv_data, int const *recv_counts, MIMPI_Op op) {
+    int displs[size];
+    int offset = 0;
+    for (int i = 0; i < size; ++i) {
+        displs[i] = offset;
+        offset += recv_counts[i];
     }
-    if (group_num(rank, MIMPI_Right) < size) {
-        if (send_data_fn(determine_gwrite(MIMPI_Right), count, data_to_send) == MIMPI_ERROR_REMOTE_FINISHED) {
-            free(data_array[0]);
-            free(data_array[1]);
+    int count = recv_counts[rank];
+    void* contribution = malloc(count);
+    memcpy(recv_data, send_data + displs[rank], count);
+    for (int step = 1; step < size; ++step) {
+        int to, from;
+        exchange_partners(step, &to, &from);
+        if (send_message(send_data + displs[to], recv_counts[to], to, REDUCE_SCATTER_TAG) == MIMPI_ERROR_REMOTE_FINISHED
+            || recv_message(contribution, count, from, REDUCE_SCATTER_TAG, false) == MIMPI_ERROR_REMOTE_FINISHED) {
+            free(contribution);
             return MIMPI_ERROR_REMOTE_FINISHED;
         }
+        perform_op(recv_data, contribution, count, op);
+    }
+    free(contribution);
+    return MIMPI_SUCCESS;
+}
+
+static MIMPI_Retcode reduce_scatter_block_call(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    MIMPI_Op op
+) {
+    wait_collectives();
+    int counts[size];
+    for (int i = 0; i < size; ++i) {
+        counts[i] = count;
     }
+    return collective_done(reduce_scatter_pairwise(send_data, recv_data, counts, op));
+}
+
+MIMPI_Retcode PMIMPI_Reduce_scatter_block(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    MIMPI_Op op
+) {
+    TRACED("MIMPI_Reduce_scatter_block", reduce_scatter_block_call(send_data, recv_data, count, op));
+}
+
+static MIMPI_Retcode reduce_scatter_call(
+    void const *send_data,
+    void *recv_data,
+    int const *recv_counts,
+    MIMPI_Op op
+) {
+    wait_collectives();
+    return collective_done(reduce_scatter_pairwise(send_data, recv_data, recv_counts, op));
+}
+
+MIMPI_Retcode PMIMPI_Reduce_scatter(
+    void const *send_data,
+    void *recv_data,
+    int const *recv_counts,
+    MIMPI_Op op
+) {
+    TRACED("MIMPI_Reduce_scatter", reduce_scatter_call(send_data, recv_data, recv_counts, op));
+}
 
-    free(data_array[0]);
-    free(data_array[1]);
+// Hillis-Steele: after round k, partial holds the reduction of the 2^k processes ending at this one.
+// Values received on the way cover all preceding processes exactly once, giving the exclusive prefix.
+static MIMPI_Retcode scan_p2p(void const *send_data, void *recv_data, int count, MIMPI_Op op, bool exclusive) {
+    void* partial = malloc(count);
+    void* received = malloc(count);
+    memcpy(partial, send_data, count);
+    bool has_prefix = false;
+    for (int distance = 1; distance < size; distance *= 2) {
+        if (rank + distance < size) {
+            if (send_message(partial, count, rank + distance, SCAN_TAG) == MIMPI_ERROR_REMOTE_FINISHED) {
+                free(partial);
+                free(received);
+                return MIMPI_ERROR_REMOTE_FINISHED;
+            }
+        }
+        if (rank - distance >= 0) {
+            if (recv_message(received, count, rank - distance, SCAN_TAG, false) == MIMPI_ERROR_REMOTE_FINISHED) {
+                free(partial);
+                free(received);
+                return MIMPI_ERROR_REMOTE_FINISHED;
+            }
+            if (exclusive) {
+                if (has_prefix) {
+                    perform_op(recv_data, received, count, op);
+                } else {
+                    memcpy(recv_data, received, count);
+                    has_prefix = true;
+                }
+            }
+            perform_op(partial, received, count, op);
+        }
+    }
+    if (!exclusive) {
+        memcpy(recv_data, partial, count);
+    }
+    free(partial);
+    free(received);
     return MIMPI_SUCCESS;
+}
 
+static MIMPI_Retcode scan_call(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    MIMPI_Op op
+) {
+    wait_collectives();
+    return collective_done(scan_p2p(send_data, recv_data, count, op, false));
 }
 
-MIMPI_Retcode MIMPI_Reduce(
+MIMPI_Retcode PMIMPI_Scan(
     void const *send_data,
     void *recv_data,
     int count,
-    MIMPI_Op op,
-    int root
+    MIMPI_Op op
 ) {
-    if (root >= size) {
+    TRACED("MIMPI_Scan", scan_call(send_data, recv_data, count, op));
+}
+
+static MIMPI_Retcode exscan_call(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    MIMPI_Op op
+) {
+    wait_collectives();
+    return collective_done(scan_p2p(send_data, recv_data, count, op, true));
+}
+
+MIMPI_Retcode PMIMPI_Exscan(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    MIMPI_Op op
+) {
+    TRACED("MIMPI_Exscan", exscan_call(send_data, recv_data, count, op));
+}
+
+int PMIMPI_Comm_size(MIMPI_Comm comm) {
+    return comm->size;
+}
+
+int PMIMPI_Comm_rank(MIMPI_Comm comm) {
+    return comm->rank;
+}
+
+static MIMPI_Retcode comm_send_call(
+    void const *data,
+    int count,
+    int destination,
+    int tag,
+    MIMPI_Comm comm
+) {
+    if (destination == comm->rank) {
+        return MIMPI_ERROR_ATTEMPTED_SELF_OP;
+    }
+    if (destination < 0 || destination >= comm->size) {
         return MIMPI_ERROR_NO_SUCH_RANK;
     }
-    void* data = malloc(count);
-    memcpy(data, send_data, count);
-    void* data_array[2];
-    data_array[0] = malloc(count);
-    memset(data_array[0], 0, count);
-    data_array[1] = malloc(count);
-    memset(data_array[1], 0, count);
-    if (group_num(rank, MIMPI_Left) < size) {
-        if (read_data_fn(determine_gread(MIMPI_Left), count, data_array[0]) == MIMPI_ERROR_REMOTE_FINISHED) {
-            free(data);
-            free(data_array[0]);
-            free(data_array[1]);
-            return MIMPI_ERROR_REMOTE_FINISHED;
-        }
-        perform_op(data, data_array[0], count, op);
+    long long started = now_ns();
+    return latency_done(
+        MIMPI_LATENCY_SEND, started, send_user_message(data, count, comm->ranks[destination], tag, comm->context));
+}
+
+MIMPI_Retcode PMIMPI_Comm_send(
+    void const *data,
+    int count,
+    int destination,
+    int tag,
+    MIMPI_Comm comm
+) {
+    TRACED("MIMPI_Comm_send", comm_send_call(data, count, destination, tag, comm));
+}
 
+static MIMPI_Retcode comm_recv_call(
+    void *data,
+    int count,
+    int source,
+    int tag,
+    MIMPI_Comm comm
+) {
+    if (source == comm->rank) {
+        return MIMPI_ERROR_ATTEMPTED_SELF_OP;
+    }
+    if (source < 0 || source >= comm->size) {
+        return MIMPI_ERROR_NO_SUCH_RANK;
     }
-    if (group_num(rank, MIMPI_Right) < size) {
-        if (read_data_fn(determine_gread(MIMPI_Right), count, data_array[1]) == MIMPI_ERROR_REMOTE_FINISHED) {
-            free(data);
-            free(data_array[0]);
-            free(data_array[1]);
+    return recv_context_message(data, count, comm->ranks[source], tag, comm->context, deadlock_detection);
+}
+
+MIMPI_Retcode PMIMPI_Comm_recv(
+    void *data,
+    int count,
+    int source,
+    int tag,
+    MIMPI_Comm comm
+) {
+    TRACED("MIMPI_Comm_recv", comm_recv_call(data, count, source, tag, comm));
+}
+
+static MIMPI_Retcode comm_send(MIMPI_Comm comm, void const *data, int count, int destination, int tag) {
+    return send_context_message(data, count, comm->ranks[destination], tag, comm->context);
+}
+
+static MIMPI_Retcode comm_recv(MIMPI_Comm comm, void *data, int count, int source, int tag) {
+    return recv_context_message(data, count, comm->ranks[source], tag, comm->context, false);
+}
+
+// Collectives of communicators use only their processes' point-to-point channels, so disjoint
+// communicators run them in parallel. Binomial trees are rooted at the collective's root.
+static MIMPI_Retcode comm_barrier_call(MIMPI_Comm comm) {
+    for (int distance = 1; distance < comm->size; distance *= 2) {
+        int to = (comm->rank + distance) % comm->size;
+        int from = (comm->rank - distance + comm->size) % comm->size;
+        if (comm_send(comm, NULL, 0, to, COMM_BARRIER_TAG) == MIMPI_ERROR_REMOTE_FINISHED
+            || comm_recv(comm, NULL, 0, from, COMM_BARRIER_TAG) == MIMPI_ERROR_REMOTE_FINISHED) {
             return MIMPI_ERROR_REMOTE_FINISHED;
         }
-        perform_op(data, data_array[1], count, op);
     }
+    return MIMPI_SUCCESS;
+}
 
-    if (group_num(rank, MIMPI_Father) >= 0) {
-        if (send_data_fn(determine_gwrite(MIMPI_Father), count, data) == MIMPI_ERROR_REMOTE_FINISHED) {
-            free(data);
-            free(data_array[0]);
-            free(data_array[1]);
-            return MIMPI_ERROR_REMOTE_FINISHED;
+MIMPI_Retcode PMIMPI_Comm_barrier(MIMPI_Comm comm) {
+    TRACED("MIMPI_Comm_barrier", comm_barrier_call(comm));
+}
+
+static MIMPI_Retcode comm_bcast_call(
+    void *data,
+    int count,
+    int root,
+    MIMPI_Comm comm
+) {
+    if (root < 0 || root >= comm->size) {
+        return MIMPI_ERROR_NO_SUCH_RANK;
+    }
+    int relative = (comm->rank - root + comm->size) % comm->size;
+    int mask = 1;
+    while (mask < comm->size) {
+        if (relative & mask) {
+            int parent = (relative - mask + root) % comm->size;
+            if (comm_recv(comm, data, count, parent, COMM_BCAST_TAG) == MIMPI_ERROR_REMOTE_FINISHED) {
+                return MIMPI_ERROR_REMOTE_FINISHED;
+            }
+            break;
+        }
+        mask *= 2;
+    }
+    for (mask /= 2; mask > 0; mask /= 2) {
+        if (relative + mask < comm->size) {
+            int child = (relative + mask + root) % comm->size;
+            if (comm_send(comm, data, count, child, COMM_BCAST_TAG) == MIMPI_ERROR_REMOTE_FINISHED) {
+                return MIMPI_ERROR_REMOTE_FINISHED;
+            }
         }
+    }
+    return MIMPI_SUCCESS;
+}
 
-        if (read_data_fn(determine_gread(MIMPI_Father), count, data) == MIMPI_ERROR_REMOTE_FINISHED) {
-            free(data);
-            free(data_array[0]);
-            free(data_array[1]);
-            return MIMPI_ERROR_REMOTE_FINISHED;
+MIMPI_Retcode PMIMPI_Comm_bcast(
+    void *data,
+    int count,
+    int root,
+    MIMPI_Comm comm
+) {
+    TRACED("MIMPI_Comm_bcast", comm_bcast_call(data, count, root, comm));
+}
+
+static MIMPI_Retcode comm_reduce_call(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    MIMPI_Op op,
+    int root,
+    MIMPI_Comm comm
+) {
+    if (root < 0 || root >= comm->size) {
+        return MIMPI_ERROR_NO_SUCH_RANK;
+    }
+    void* partial = malloc(count);
+    void* received = malloc(count);
+    memcpy(partial, send_data, count);
+    MIMPI_Retcode ret = MIMPI_SUCCESS;
+    int relative = (comm->rank - root + comm->size) % comm->size;
+    for (int mask = 1; mask < comm->size; mask *= 2) {
+        if (relative & mask) {
+            int parent = (relative - mask + root) % comm->size;
+            ret = comm_send(comm, partial, count, parent, COMM_REDUCE_TAG);
+            break;
+        }
+        if (relative + mask < comm->size) {
+            int child = (relative + mask + root) % comm->size;
+            ret = comm_recv(comm, received, count, child, COMM_REDUCE_TAG);
+            if (ret != MIMPI_SUCCESS) {
+                break;
+            }
+            perform_op(partial, received, count, op);
         }
     }
+    if (ret == MIMPI_SUCCESS && relative == 0) {
+        memcpy(recv_data, partial, count);
+    }
+    free(partial);
+    free(received);
+    return ret;
+}
 
-    if (rank == root) {
-        memcpy(recv_data, data, count);
+MIMPI_Retcode PMIMPI_Comm_reduce(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    MIMPI_Op op,
+    int root,
+    MIMPI_Comm comm
+) {
+    TRACED("MIMPI_Comm_reduce", comm_reduce_call(send_data, recv_data, count, op, root, comm));
+}
+
+struct split_entry {
+    int color;
+    int key;
+    int rank;
+    int next_context;
+};
+
+static int compare_split_entries(void const* a, void const* b) {
+    struct split_entry const* first = a;
+    struct split_entry const* second = b;
+    if (first->key != second->key) {
+        return first->key < second->key ? -1 : 1;
     }
+    return first->rank - second->rank;
+}
 
-    if (group_num(rank, MIMPI_Left) < size) {
-        if (send_data_fn(determine_gwrite(MIMPI_Left), count, data) == MIMPI_ERROR_REMOTE_FINISHED) {
-            free(data);
-            free(data_array[0]);
-            free(data_array[1]);
-            return MIMPI_ERROR_REMOTE_FINISHED;
+// Every process learns the color, key and next context of all processes in comm.
+// The new context is the largest of them, so it's unused by each process of the new communicator,
+// and every process of comm moves past it to keep later communicators apart.
+static MIMPI_Retcode comm_split_call(
+    MIMPI_Comm comm,
+    int color,
+    int key,
+    MIMPI_Comm *new_comm
+) {
+    *new_comm = MIMPI_COMM_NULL;
+    struct split_entry* entries = malloc(comm->size * sizeof(struct split_entry));
+    struct split_entry own = {color, key, comm->rank, next_context};
+    MIMPI_Retcode ret = MIMPI_SUCCESS;
+    if (comm->rank == 0) {
+        entries[0] = own;
+        for (int i = 1; i < comm->size && ret == MIMPI_SUCCESS; ++i) {
+            ret = comm_recv(comm, &entries[i], sizeof(struct split_entry), i, COMM_SPLIT_TAG);
         }
+    } else {
+        ret = comm_send(comm, &own, sizeof(struct split_entry), 0, COMM_SPLIT_TAG);
     }
-    if (group_num(rank, MIMPI_Right) < size) {
-        if (send_data_fn(determine_gwrite(MIMPI_Right), count, data) == MIMPI_ERROR_REMOTE_FINISHED) {
-            free(data);
-            free(data_array[0]);
-            free(data_array[1]);
-            return MIMPI_ERROR_REMOTE_FINISHED;
+    if (ret == MIMPI_SUCCESS) {
+        ret = PMIMPI_Comm_bcast(entries, comm->size * sizeof(struct split_entry), 0, comm);
+    }
+    if (ret != MIMPI_SUCCESS) {
+        free(entries);
+        return ret;
+    }
+
+    int context = next_context;
+    int members = 0;
+    for (int i = 0; i < comm->size; ++i) {
+        context = max(context, entries[i].next_context);
+        if (color >= 0 && entries[i].color == color) {
+            entries[members++] = entries[i];
         }
     }
-    free(data);
-    free(data_array[0]);
-    free(data_array[1]);
+    next_context = context + 1;
+    if (color < 0) {
+        free(entries);
+        return MIMPI_SUCCESS;
+    }
+    qsort(entries, members, sizeof(struct split_entry), compare_split_entries);
+    struct mimpi_comm* created = malloc(sizeof(struct mimpi_comm));
+    created->context = context;
+    created->size = members;
+    created->ranks = malloc(members * sizeof(int));
+    for (int i = 0; i < members; ++i) {
+        if (entries[i].rank == comm->rank) {
+            created->rank = i;
+        }
+        created->ranks[i] = comm->ranks[entries[i].rank];
+    }
+    free(entries);
+    *new_comm = created;
     return MIMPI_SUCCESS;
-}
\ No newline at end of file
+}
+
+MIMPI_Retcode PMIMPI_Comm_split(
+    MIMPI_Comm comm,
+    int color,
+    int key,
+    MIMPI_Comm *new_comm
+) {
+    TRACED("MIMPI_Comm_split", comm_split_call(comm, color, key, new_comm));
+}
+
+static MIMPI_Retcode comm_dup_call(MIMPI_Comm comm, MIMPI_Comm *new_comm) {
+    return PMIMPI_Comm_split(comm, 0, comm->rank, new_comm);
+}
+
+MIMPI_Retcode PMIMPI_Comm_dup(MIMPI_Comm comm, MIMPI_Comm *new_comm) {
+    TRACED("MIMPI_Comm_dup", comm_dup_call(comm, new_comm));
+}
+
+static void comm_free_call(MIMPI_Comm *comm) {
+    if (*comm == MIMPI_COMM_NULL || *comm == MIMPI_COMM_WORLD) {
+        return;
+    }
+    free((*comm)->ranks);
+    free(*comm);
+    *comm = MIMPI_COMM_NULL;
+}
+
+void PMIMPI_Comm_free(MIMPI_Comm *comm) {
+    if (tracing) {
+        trace_event('B', "MIMPI_Comm_free", 0, 0, 0);
+        comm_free_call(comm);
+        trace_event('E', "MIMPI_Comm_free", 0, 0, 0);
+        return;
+    }
+    comm_free_call(comm);
+}
+
+// MIMPI_ names are weak aliases of the PMIMPI_ ones, so that a profiling library can define its own and call
+// the PMIMPI_ ones for the work.
+#pragma weak MIMPI_Init = PMIMPI_Init
+#pragma weak MIMPI_Finalize = PMIMPI_Finalize
+#pragma weak MIMPI_World_size = PMIMPI_World_size
+#pragma weak MIMPI_World_rank = PMIMPI_World_rank
+#pragma weak MIMPI_Send = PMIMPI_Send
+#pragma weak MIMPI_Recv = PMIMPI_Recv
+#pragma weak MIMPI_Barrier = PMIMPI_Barrier
+#pragma weak MIMPI_Bcast = PMIMPI_Bcast
+#pragma weak MIMPI_Reduce = PMIMPI_Reduce
+#pragma weak MIMPI_Gather = PMIMPI_Gather
+#pragma weak MIMPI_Gatherv = PMIMPI_Gatherv
+#pragma weak MIMPI_Scatter = PMIMPI_Scatter
+#pragma weak MIMPI_Scatterv = PMIMPI_Scatterv
+#pragma weak MIMPI_Allgather = PMIMPI_Allgather
+#pragma weak MIMPI_Allgatherv = PMIMPI_Allgatherv
+#pragma weak MIMPI_Alltoall = PMIMPI_Alltoall
+#pragma weak MIMPI_Alltoallv = PMIMPI_Alltoallv
+#pragma weak MIMPI_Reduce_scatter_block = PMIMPI_Reduce_scatter_block
+#pragma weak MIMPI_Reduce_scatter = PMIMPI_Reduce_scatter
+#pragma weak MIMPI_Scan = PMIMPI_Scan
+#pragma weak MIMPI_Exscan = PMIMPI_Exscan
+#pragma weak MIMPI_Ibarrier = PMIMPI_Ibarrier
+#pragma weak MIMPI_Ibcast = PMIMPI_Ibcast
+#pragma weak MIMPI_Ireduce = PMIMPI_Ireduce
+#pragma weak MIMPI_Wait = PMIMPI_Wait
+#pragma weak MIMPI_Test = PMIMPI_Test
+#pragma weak MIMPI_Get_stats = PMIMPI_Get_stats
+#pragma weak MIMPI_Get_latency = PMIMPI_Get_latency
+#pragma weak MIMPI_Recv_timeout = PMIMPI_Recv_timeout
+#pragma weak MIMPI_Barrier_timeout = PMIMPI_Barrier_timeout
+#pragma weak MIMPI_Bcast_timeout = PMIMPI_Bcast_timeout
+#pragma weak MIMPI_Reduce_timeout = PMIMPI_Reduce_timeout
+#pragma weak MIMPI_Comm_size = PMIMPI_Comm_size
+#pragma weak MIMPI_Comm_rank = PMIMPI_Comm_rank
+#pragma weak MIMPI_Comm_split = PMIMPI_Comm_split
+#pragma weak MIMPI_Comm_dup = PMIMPI_Comm_dup
+#pragma weak MIMPI_Comm_free = PMIMPI_Comm_free
+#pragma weak MIMPI_Comm_send = PMIMPI_Comm_send
+#pragma weak MIMPI_Comm_recv = PMIMPI_Comm_recv
+#pragma weak MIMPI_Comm_barrier = PMIMPI_Comm_barrier
+#pragma weak MIMPI_Comm_bcast = PMIMPI_Comm_bcast
+#pragma weak MIMPI_Comm_reduce = PMIMPI_Comm_reduce
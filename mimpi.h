@@ -12,6 +12,8 @@ typedef enum {
     MIMPI_ERROR_NO_SUCH_RANK = 2, /// no process with requested rank exists in the world
     MIMPI_ERROR_REMOTE_FINISHED = 3, /// the remote process involved in communication has finished
     MIMPI_ERROR_DEADLOCK_DETECTED = 4, /// a deadlock has been detected
+    MIMPI_ERROR_TIMEOUT = 5, /// the operation didn't complete before its timeout
+    MIMPI_ERROR_INVALID_ARGUMENT = 6, /// an argument is out of its range
 } MIMPI_Retcode;
 
 /// @brief Reduction operation kind.
@@ -24,12 +26,33 @@ typedef enum {
     MIMPI_PROD,
 } MIMPI_Op;
 
+/// @brief Handle of a nonblocking collective operation.
+///
+/// Returned by @ref MIMPI_Ibarrier, @ref MIMPI_Ibcast and @ref MIMPI_Ireduce,
+/// and released by @ref MIMPI_Wait or a successful @ref MIMPI_Test.
+typedef struct mimpi_request* MIMPI_Request;
+
+/// @brief Handle of a communicator, a group of processes with its own ranks.
+///
+/// Messages and collectives of different communicators never match each other.
+typedef struct mimpi_comm* MIMPI_Comm;
+
+/// Communicator of all processes launched by `mimpirun`.
+extern MIMPI_Comm const MIMPI_COMM_WORLD;
+
+/// Handle that refers to no communicator.
+#define MIMPI_COMM_NULL ((MIMPI_Comm)0)
+
+/// Color passed to @ref MIMPI_Comm_split by processes that join no new communicator.
+#define MIMPI_UNDEFINED (-1)
+
 /// @brief Initialises MIMPI framework in MIMPI programs.
 ///
 /// Opens an _MPI block_, permitting use of other MIMPI procedures.
 /// @param enable_deadlock_detection - a flag whether deadlock detection
-///        should be enabled or not. Note that this adds a considerable
-///        overhead, so should only be used when needed.
+///        should be enabled or not. On a single host, waits are published
+///        in shared memory and no messages are added until a deadlock is
+///        found; across hosts every blocking call sends probes.
 ///
 void MIMPI_Init(bool enable_deadlock_detection);
 
@@ -175,4 +198,623 @@ MIMPI_Retcode MIMPI_Reduce(
     int root
 );
 
+/// @brief Gathers data from all processes in one.
+///
+/// Collects @ref count bytes of data at address @ref send_data from every process
+/// and puts them in process @ref root at @ref recv_data, ordered by rank:
+/// data of the process with rank `i` starts at byte `i * count`.
+/// Blocks are aggregated along a binomial tree rooted at @ref root, so it
+/// receives whole subtrees at once rather than a message from every process.
+///
+/// @param send_data - data to be gathered.
+/// @param recv_data - for @ref root, place for `count * MIMPI_World_size()` bytes
+///                    of gathered data; ignored in other processes.
+/// @param count - number of bytes of data sent by every process.
+/// @param root - rank of the process who is to hold the gathered data.
+///
+/// @return MIMPI return code:
+///         - `MIMPI_SUCCESS` if operation ended successfully.
+///         - `MIMPI_ERROR_NO_SUCH_RANK` if there is no process with rank
+///           @ref root in the world.
+///         - `MIMPI_ERROR_REMOTE_FINISHED` if any process in the world
+///            has already escaped _MPI block_.
+///
+MIMPI_Retcode MIMPI_Gather(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    int root
+);
+
+/// @brief Gathers data of varying sizes from all processes in one.
+///
+/// Works like @ref MIMPI_Gather, but every process may send a different
+/// number of bytes. Data of the process with rank `i` is put in @ref root
+/// at @ref recv_data + `displs[i]`, truncated to `recv_counts[i]` bytes.
+///
+/// @param send_data - data to be gathered.
+/// @param send_count - number of bytes of data sent by this process.
+/// @param recv_data - for @ref root, place where gathered data are to be put.
+/// @param recv_counts - for @ref root, maximal number of bytes to be received from every process.
+/// @param displs - for @ref root, offsets in @ref recv_data of data from every process.
+/// @param root - rank of the process who is to hold the gathered data.
+///
+/// @return MIMPI return code, as in @ref MIMPI_Gather.
+///
+MIMPI_Retcode MIMPI_Gatherv(
+    void const *send_data,
+    int send_count,
+    void *recv_data,
+    int const *recv_counts,
+    int const *displs,
+    int root
+);
+
+/// @brief Scatters data from one process to all processes.
+///
+/// Process with rank `i` receives at @ref recv_data @ref count bytes
+/// stored in process @ref root at @ref send_data + `i * count`.
+/// Blocks travel down a binomial tree rooted at @ref root, and each process
+/// receives only the blocks of its own subtree.
+///
+/// @param send_data - for @ref root, `count * MIMPI_World_size()` bytes of data to be scattered;
+///                    ignored in other processes.
+/// @param recv_data - place where received data is to be put.
+/// @param count - number of bytes of data received by every process.
+/// @param root - rank of the process whose data are to be scattered.
+///
+/// @return MIMPI return code:
+///         - `MIMPI_SUCCESS` if operation ended successfully.
+///         - `MIMPI_ERROR_NO_SUCH_RANK` if there is no process with rank
+///           @ref root in the world.
+///         - `MIMPI_ERROR_REMOTE_FINISHED` if any process in the world
+///            has already escaped _MPI block_.
+///
+MIMPI_Retcode MIMPI_Scatter(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    int root
+);
+
+/// @brief Scatters data of varying sizes from one process to all processes.
+///
+/// Works like @ref MIMPI_Scatter, but process with rank `i` receives
+/// `send_counts[i]` bytes stored in @ref root at @ref send_data + `displs[i]`,
+/// truncated to @ref recv_count bytes.
+///
+/// @param send_data - for @ref root, data to be scattered.
+/// @param send_counts - for @ref root, number of bytes to be sent to every process.
+/// @param displs - for @ref root, offsets in @ref send_data of data for every process.
+/// @param recv_data - place where received data is to be put.
+/// @param recv_count - maximal number of bytes to be received.
+/// @param root - rank of the process whose data are to be scattered.
+///
+/// @return MIMPI return code, as in @ref MIMPI_Scatter.
+///
+MIMPI_Retcode MIMPI_Scatterv(
+    void const *send_data,
+    int const *send_counts,
+    int const *displs,
+    void *recv_data,
+    int recv_count,
+    int root
+);
+
+/// @brief Gathers data from all processes in all processes.
+///
+/// Collects @ref count bytes of data at address @ref send_data from every process
+/// and puts them in every process at @ref recv_data, ordered by rank:
+/// data of the process with rank `i` starts at byte `i * count`.
+/// Data travel over the point-to-point channels: small blocks
+/// take `ceil(log2(n))` rounds (Bruck's algorithm), large ones `n - 1` steps
+/// around a ring, in which every block crosses every link once.
+///
+/// @param send_data - data to be gathered.
+/// @param recv_data - place for `count * MIMPI_World_size()` bytes of gathered data.
+/// @param count - number of bytes of data sent by every process.
+///
+/// @return MIMPI return code:
+///         - `MIMPI_SUCCESS` if operation ended successfully.
+///         - `MIMPI_ERROR_REMOTE_FINISHED` if any process in the world
+///            has already escaped _MPI block_.
+///
+MIMPI_Retcode MIMPI_Allgather(
+    void const *send_data,
+    void *recv_data,
+    int count
+);
+
+/// @brief Gathers data of varying sizes from all processes in all processes.
+///
+/// Works like @ref MIMPI_Allgather, but the process with rank `i` sends
+/// `recv_counts[i]` bytes, which are put at @ref recv_data + `displs[i]`.
+/// @ref recv_counts and @ref displs have to be the same in every process.
+///
+/// @param send_data - data to be gathered, `recv_counts[MIMPI_World_rank()]` bytes.
+/// @param recv_data - place where gathered data are to be put.
+/// @param recv_counts - number of bytes sent by every process.
+/// @param displs - offsets in @ref recv_data of data from every process.
+///
+/// @return MIMPI return code, as in @ref MIMPI_Allgather.
+///
+MIMPI_Retcode MIMPI_Allgatherv(
+    void const *send_data,
+    void *recv_data,
+    int const *recv_counts,
+    int const *displs
+);
+
+/// @brief Exchanges a separate block of data between every pair of processes.
+///
+/// Process with rank `i` sends @ref count bytes stored at @ref send_data + `j * count`
+/// to the process with rank `j`, which puts them at its @ref recv_data + `i * count`.
+/// Blocks travel over the point-to-point channels in `n - 1` steps, each being
+/// a perfect matching of processes; tiny blocks are instead combined into
+/// `ceil(log2(n))` messages (Bruck's algorithm).
+///
+/// @param send_data - `count * MIMPI_World_size()` bytes of data to be sent.
+/// @param recv_data - place for `count * MIMPI_World_size()` bytes of received data.
+/// @param count - number of bytes of data sent to every process.
+///
+/// @return MIMPI return code:
+///         - `MIMPI_SUCCESS` if operation ended successfully.
+///         - `MIMPI_ERROR_REMOTE_FINISHED` if any process in the world
+///            has already escaped _MPI block_.
+///
+MIMPI_Retcode MIMPI_Alltoall(
+    void const *send_data,
+    void *recv_data,
+    int count
+);
+
+/// @brief Exchanges a separate block of data of varying size between every pair of processes.
+///
+/// Works like @ref MIMPI_Alltoall, but the block for the process with rank `j`
+/// has `send_counts[j]` bytes at @ref send_data + `send_displs[j]`, and the block from
+/// the process with rank `j` is put at @ref recv_data + `recv_displs[j]`.
+/// `recv_counts[j]` has to be equal to `send_counts` of rank `j` for this process.
+///
+/// @param send_data - data to be sent.
+/// @param send_counts - number of bytes to be sent to every process.
+/// @param send_displs - offsets in @ref send_data of data for every process.
+/// @param recv_data - place where received data are to be put.
+/// @param recv_counts - number of bytes to be received from every process.
+/// @param recv_displs - offsets in @ref recv_data of data from every process.
+///
+/// @return MIMPI return code, as in @ref MIMPI_Alltoall.
+///
+MIMPI_Retcode MIMPI_Alltoallv(
+    void const *send_data,
+    int const *send_counts,
+    int const *send_displs,
+    void *recv_data,
+    int const *recv_counts,
+    int const *recv_displs
+);
+
+/// @brief Reduces data from all processes and scatters the result.
+///
+/// Performs reduction of kind @ref op over `count * MIMPI_World_size()` bytes of data
+/// stored at address @ref send_data in every process, and puts bytes
+/// `[i * count, (i + 1) * count)` of the result at @ref recv_data in the process with rank `i`.
+/// Every process exchanges blocks directly with every other one and reduces only its own block.
+///
+/// @param send_data - data to be reduced.
+/// @param recv_data - place for @ref count bytes of this process's part of the result.
+/// @param count - number of bytes of the result received by every process.
+/// @param op - a particular operation to be performed for reduction.
+///
+/// @return MIMPI return code:
+///         - `MIMPI_SUCCESS` if operation ended successfully.
+///         - `MIMPI_ERROR_REMOTE_FINISHED` if any process in the world
+///            has already escaped _MPI block_.
+///
+MIMPI_Retcode MIMPI_Reduce_scatter_block(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    MIMPI_Op op
+);
+
+/// @brief Reduces data from all processes and scatters parts of varying size of the result.
+///
+/// Works like @ref MIMPI_Reduce_scatter_block, but the process with rank `i` receives
+/// `recv_counts[i]` bytes of the result, the parts following one another in @ref send_data.
+/// @ref recv_counts has to be the same in every process.
+///
+/// @param send_data - data to be reduced, the sum of @ref recv_counts bytes.
+/// @param recv_data - place for this process's part of the result.
+/// @param recv_counts - number of bytes of the result received by every process.
+/// @param op - a particular operation to be performed for reduction.
+///
+/// @return MIMPI return code, as in @ref MIMPI_Reduce_scatter_block.
+///
+MIMPI_Retcode MIMPI_Reduce_scatter(
+    void const *send_data,
+    void *recv_data,
+    int const *recv_counts,
+    MIMPI_Op op
+);
+
+/// @brief Computes prefix reductions over processes.
+///
+/// Puts at @ref recv_data in the process with rank `i` the reduction of kind @ref op
+/// over @ref count bytes of data stored at @ref send_data in processes with ranks `0` to `i`.
+/// Takes `ceil(log2(n))` rounds over the point-to-point channels.
+///
+/// @param send_data - data to be reduced.
+/// @param recv_data - place where this process's prefix reduction is to be put.
+/// @param count - number of bytes of data to be reduced.
+/// @param op - a particular operation to be performed for reduction.
+///
+/// @return MIMPI return code:
+///         - `MIMPI_SUCCESS` if operation ended successfully.
+///         - `MIMPI_ERROR_REMOTE_FINISHED` if any process in the world
+///            has already escaped _MPI block_.
+///
+MIMPI_Retcode MIMPI_Scan(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    MIMPI_Op op
+);
+
+/// @brief Computes exclusive prefix reductions over processes.
+///
+/// Works like @ref MIMPI_Scan, but the reduction in the process with rank `i`
+/// is over processes with ranks `0` to `i - 1`. @ref recv_data in the process
+/// with rank `0` is left untouched.
+///
+/// @param send_data - data to be reduced.
+/// @param recv_data - place where this process's prefix reduction is to be put.
+/// @param count - number of bytes of data to be reduced.
+/// @param op - a particular operation to be performed for reduction.
+///
+/// @return MIMPI return code, as in @ref MIMPI_Scan.
+///
+MIMPI_Retcode MIMPI_Exscan(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    MIMPI_Op op
+);
+
+/// @brief Starts a nonblocking @ref MIMPI_Barrier.
+///
+/// Returns immediately; the barrier is run in the background and completed
+/// with @ref MIMPI_Wait or @ref MIMPI_Test.
+/// Nonblocking and blocking collectives are matched across processes
+/// in the order they were called, just like blocking ones alone.
+///
+/// @param request - place where the handle of the operation is to be put.
+///
+/// @return MIMPI return code:
+///         - `MIMPI_SUCCESS` if operation was started successfully.
+///
+MIMPI_Retcode MIMPI_Ibarrier(MIMPI_Request *request);
+
+/// @brief Starts a nonblocking @ref MIMPI_Bcast.
+///
+/// Works like @ref MIMPI_Ibarrier. @ref data must not be accessed
+/// until the operation is completed.
+///
+/// @param data - data to be broadcast, or place where it is to be put.
+/// @param count - number of bytes of data to be broadcast.
+/// @param root - rank of the process whose data is to be broadcast.
+/// @param request - place where the handle of the operation is to be put.
+///
+/// @return MIMPI return code:
+///         - `MIMPI_SUCCESS` if operation was started successfully.
+///         - `MIMPI_ERROR_NO_SUCH_RANK` if there is no process with rank
+///           @ref root in the world. No operation is started then.
+///
+MIMPI_Retcode MIMPI_Ibcast(
+    void *data,
+    int count,
+    int root,
+    MIMPI_Request *request
+);
+
+/// @brief Starts a nonblocking @ref MIMPI_Reduce.
+///
+/// Works like @ref MIMPI_Ibarrier. Neither @ref send_data nor @ref recv_data
+/// may be accessed until the operation is completed.
+///
+/// @param send_data - data to be reduced.
+/// @param recv_data - place where the result of the reduction is to be put (only in root).
+/// @param count - number of bytes of data to be reduced.
+/// @param op - a particular operation to be performed for reduction.
+/// @param root - rank of the process which is to receive the result.
+/// @param request - place where the handle of the operation is to be put.
+///
+/// @return MIMPI return code, as in @ref MIMPI_Ibcast.
+///
+MIMPI_Retcode MIMPI_Ireduce(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    MIMPI_Op op,
+    int root,
+    MIMPI_Request *request
+);
+
+/// @brief Waits for a nonblocking collective to complete.
+///
+/// Releases the request and sets @ref request to `NULL`.
+/// Waiting for a `NULL` request returns immediately.
+///
+/// @param request - handle of the operation.
+///
+/// @return MIMPI return code of the completed operation, as in its blocking version.
+///
+MIMPI_Retcode MIMPI_Wait(MIMPI_Request *request);
+
+/// @brief Checks whether a nonblocking collective has completed.
+///
+/// If it has, works like @ref MIMPI_Wait. Otherwise returns immediately
+/// with `MIMPI_SUCCESS` and the request is left intact.
+///
+/// @param request - handle of the operation.
+/// @param flag - place where it is put whether the operation has completed.
+///
+/// @return MIMPI return code of the completed operation, or `MIMPI_SUCCESS`
+///         if it has not completed yet.
+///
+MIMPI_Retcode MIMPI_Test(MIMPI_Request *request, bool *flag);
+
+/// @brief Counters of communication with one peer, kept since @ref MIMPI_Init.
+///
+/// Messages are the ones over point-to-point channels, including those that
+/// some collectives exchange through them; bytes are of their data.
+typedef struct {
+    long long messages_sent;
+    long long bytes_sent;
+    long long messages_received;
+    long long bytes_received;
+    int queue_depth; /// messages received from the peer and not matched by a receive yet
+    int queue_high_water; /// the highest queue_depth so far
+} MIMPI_Peer_stats;
+
+/// @brief Counters of this process, kept since @ref MIMPI_Init.
+typedef struct {
+    long long recv_blocked_ns; /// time spent waiting for messages in receives
+    long long collective_ns; /// time spent in blocking collectives
+    long long chunks_sent; /// pieces of at most 512 bytes written to pipes and group channels
+    long long chunks_received; /// pieces of at most 512 bytes read from group channels
+    long long write_calls; /// writes to channels, and io_uring submissions
+    long long read_calls; /// reads from channels
+    long long deadlock_messages; /// messages sent by the deadlock detector
+    long long deadlock_searches; /// searches of the shared table of waits
+} MIMPI_Stats;
+
+/// @brief Reads the counters of this process.
+///
+/// They are updated without locks, so a snapshot taken while other threads
+/// communicate may be slightly behind.
+/// With `MIMPI_STATS` set to a directory, every process leaves its counters
+/// there in @ref MIMPI_Finalize, and `mimpirun` merges them into `matrix`,
+/// with messages and bytes sent by every process to every other.
+///
+/// @param stats - place where the counters of the process are to be put.
+/// @param peers - array of `MIMPI_World_size()` places for the counters of
+///        every peer (the one of this process is zeroed), or `NULL`.
+///
+/// @return MIMPI return code:
+///         - `MIMPI_SUCCESS` if operation ended successfully.
+///
+MIMPI_Retcode MIMPI_Get_stats(MIMPI_Stats *stats, MIMPI_Peer_stats *peers);
+
+/// @brief Kind of calls whose latencies are recorded.
+typedef enum {
+    MIMPI_LATENCY_SEND, /// @ref MIMPI_Send and @ref MIMPI_Comm_send
+    MIMPI_LATENCY_RECV_MATCH, /// @ref MIMPI_Recv and @ref MIMPI_Comm_recv, from the call until a message matches
+    MIMPI_LATENCY_RECV_COPY, /// @ref MIMPI_Recv and @ref MIMPI_Comm_recv, copying the matched message out
+    MIMPI_LATENCY_BARRIER, /// @ref MIMPI_Barrier
+    MIMPI_LATENCY_BCAST, /// @ref MIMPI_Bcast
+    MIMPI_LATENCY_REDUCE, /// @ref MIMPI_Reduce
+    MIMPI_LATENCY_KINDS,
+} MIMPI_Latency;
+
+/// @brief Reads a percentile of latencies of this process's successful calls.
+///
+/// Latencies are kept in log-scale buckets, each covering about 3% of its
+/// values, so the result is the highest value of the bucket the percentile
+/// falls in (but not above the longest call). Timed calls are recorded with
+/// the plain ones.
+/// With `MIMPI_LATENCY` set, every process prints a table of p50, p90, p99
+/// and p99.9 of all kinds to the standard error in @ref MIMPI_Finalize.
+///
+/// @param kind - kind of calls.
+/// @param percentile - percentile from 0 to 100.
+/// @param ns - place where the latency in nanoseconds is to be put,
+///        0 if no calls were recorded.
+/// @param calls - place where the number of recorded calls is to be put, or `NULL`.
+///
+/// @return MIMPI return code:
+///         - `MIMPI_SUCCESS` if operation ended successfully.
+///         - `MIMPI_ERROR_INVALID_ARGUMENT` if @ref kind is not a kind of calls,
+///           or @ref percentile is outside [0, 100].
+///
+MIMPI_Retcode MIMPI_Get_latency(MIMPI_Latency kind, double percentile, long long *ns, long long *calls);
+
+/// @brief Works like @ref MIMPI_Recv, but gives up after @ref timeout_ms milliseconds.
+///
+/// A message that arrives after the timeout stays queued for a later receive.
+///
+/// @return MIMPI return code, as in @ref MIMPI_Recv, or:
+///         - `MIMPI_ERROR_TIMEOUT` if no matching message arrived in time.
+///
+MIMPI_Retcode MIMPI_Recv_timeout(
+    void *data,
+    int count,
+    int source,
+    int tag,
+    int timeout_ms
+);
+
+/// @brief Works like @ref MIMPI_Barrier, but gives up after @ref timeout_ms milliseconds.
+///
+/// A collective that timed out has left processes out of step, so after
+/// `MIMPI_ERROR_TIMEOUT` no more collectives may be called in the _MPI block_.
+///
+/// @return MIMPI return code, as in @ref MIMPI_Barrier, or:
+///         - `MIMPI_ERROR_TIMEOUT` if the other processes didn't arrive in time.
+///
+MIMPI_Retcode MIMPI_Barrier_timeout(int timeout_ms);
+
+/// @brief Works like @ref MIMPI_Bcast, but gives up after @ref timeout_ms milliseconds,
+///        as in @ref MIMPI_Barrier_timeout.
+MIMPI_Retcode MIMPI_Bcast_timeout(
+    void *data,
+    int count,
+    int root,
+    int timeout_ms
+);
+
+/// @brief Works like @ref MIMPI_Reduce, but gives up after @ref timeout_ms milliseconds,
+///        as in @ref MIMPI_Barrier_timeout.
+MIMPI_Retcode MIMPI_Reduce_timeout(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    MIMPI_Op op,
+    int root,
+    int timeout_ms
+);
+
+/// @brief Returns the number of processes in @ref comm.
+int MIMPI_Comm_size(MIMPI_Comm comm);
+
+/// @brief Returns the rank of this process in @ref comm.
+int MIMPI_Comm_rank(MIMPI_Comm comm);
+
+/// @brief Splits a communicator into disjoint ones.
+///
+/// Processes of @ref comm that passed the same @ref color form a new communicator,
+/// in which they are ranked by @ref key, and then by their rank in @ref comm.
+/// Must be called by all processes of @ref comm, like a collective.
+/// Collectives of the new communicators run over point-to-point channels only,
+/// so those of disjoint communicators can proceed in parallel.
+///
+/// @param comm - communicator to be split.
+/// @param color - nonnegative identifier of the new communicator, or `MIMPI_UNDEFINED`.
+/// @param key - place of this process in the new communicator.
+/// @param new_comm - place where the new communicator is to be put;
+///        `MIMPI_COMM_NULL` for processes with `MIMPI_UNDEFINED` color.
+///
+/// @return MIMPI return code:
+///         - `MIMPI_SUCCESS` if operation ended successfully.
+///         - `MIMPI_ERROR_REMOTE_FINISHED` if any process of @ref comm
+///            has already escaped _MPI block_.
+///
+MIMPI_Retcode MIMPI_Comm_split(
+    MIMPI_Comm comm,
+    int color,
+    int key,
+    MIMPI_Comm *new_comm
+);
+
+/// @brief Creates a communicator of the same processes with the same ranks as @ref comm.
+///
+/// Works like @ref MIMPI_Comm_split with the same color everywhere.
+///
+MIMPI_Retcode MIMPI_Comm_dup(MIMPI_Comm comm, MIMPI_Comm *new_comm);
+
+/// @brief Releases a communicator created by @ref MIMPI_Comm_split or @ref MIMPI_Comm_dup.
+///
+/// Sets @ref comm to `MIMPI_COMM_NULL`. `MIMPI_COMM_WORLD` is never released.
+///
+void MIMPI_Comm_free(MIMPI_Comm *comm);
+
+/// @brief Works like @ref MIMPI_Send, with ranks in @ref comm.
+MIMPI_Retcode MIMPI_Comm_send(
+    void const *data,
+    int count,
+    int destination,
+    int tag,
+    MIMPI_Comm comm
+);
+
+/// @brief Works like @ref MIMPI_Recv, with ranks in @ref comm.
+MIMPI_Retcode MIMPI_Comm_recv(
+    void *data,
+    int count,
+    int source,
+    int tag,
+    MIMPI_Comm comm
+);
+
+/// @brief Works like @ref MIMPI_Barrier, among processes of @ref comm.
+MIMPI_Retcode MIMPI_Comm_barrier(MIMPI_Comm comm);
+
+/// @brief Works like @ref MIMPI_Bcast, among processes of @ref comm.
+MIMPI_Retcode MIMPI_Comm_bcast(
+    void *data,
+    int count,
+    int root,
+    MIMPI_Comm comm
+);
+
+/// @brief Works like @ref MIMPI_Reduce, among processes of @ref comm.
+MIMPI_Retcode MIMPI_Comm_reduce(
+    void const *send_data,
+    void *recv_data,
+    int count,
+    MIMPI_Op op,
+    int root,
+    MIMPI_Comm comm
+);
+
+/// @brief Profiling interface.
+///
+/// Every function above is also exported with the `PMIMPI_` prefix, and its
+/// `MIMPI_` name is only a weak alias, as in the PMPI convention of MPI.
+/// A profiling library linked with the program can thus define its own
+/// `MIMPI_Send`, for instance, and call `PMIMPI_Send` to send the message.
+/// Calls that MIMPI makes to itself go to the `PMIMPI_` functions, so that
+/// the library sees only the calls of the program.
+extern __typeof__(MIMPI_Init) PMIMPI_Init;
+extern __typeof__(MIMPI_Finalize) PMIMPI_Finalize;
+extern __typeof__(MIMPI_World_size) PMIMPI_World_size;
+extern __typeof__(MIMPI_World_rank) PMIMPI_World_rank;
+extern __typeof__(MIMPI_Send) PMIMPI_Send;
+extern __typeof__(MIMPI_Recv) PMIMPI_Recv;
+extern __typeof__(MIMPI_Barrier) PMIMPI_Barrier;
+extern __typeof__(MIMPI_Bcast) PMIMPI_Bcast;
+extern __typeof__(MIMPI_Reduce) PMIMPI_Reduce;
+extern __typeof__(MIMPI_Gather) PMIMPI_Gather;
+extern __typeof__(MIMPI_Gatherv) PMIMPI_Gatherv;
+extern __typeof__(MIMPI_Scatter) PMIMPI_Scatter;
+extern __typeof__(MIMPI_Scatterv) PMIMPI_Scatterv;
+extern __typeof__(MIMPI_Allgather) PMIMPI_Allgather;
+extern __typeof__(MIMPI_Allgatherv) PMIMPI_Allgatherv;
+extern __typeof__(MIMPI_Alltoall) PMIMPI_Alltoall;
+extern __typeof__(MIMPI_Alltoallv) PMIMPI_Alltoallv;
+extern __typeof__(MIMPI_Reduce_scatter_block) PMIMPI_Reduce_scatter_block;
+extern __typeof__(MIMPI_Reduce_scatter) PMIMPI_Reduce_scatter;
+extern __typeof__(MIMPI_Scan) PMIMPI_Scan;
+extern __typeof__(MIMPI_Exscan) PMIMPI_Exscan;
+extern __typeof__(MIMPI_Ibarrier) PMIMPI_Ibarrier;
+extern __typeof__(MIMPI_Ibcast) PMIMPI_Ibcast;
+extern __typeof__(MIMPI_Ireduce) PMIMPI_Ireduce;
+extern __typeof__(MIMPI_Wait) PMIMPI_Wait;
+extern __typeof__(MIMPI_Test) PMIMPI_Test;
+extern __typeof__(MIMPI_Get_stats) PMIMPI_Get_stats;
+extern __typeof__(MIMPI_Get_latency) PMIMPI_Get_latency;
+extern __typeof__(MIMPI_Recv_timeout) PMIMPI_Recv_timeout;
+extern __typeof__(MIMPI_Barrier_timeout) PMIMPI_Barrier_timeout;
+extern __typeof__(MIMPI_Bcast_timeout) PMIMPI_Bcast_timeout;
+extern __typeof__(MIMPI_Reduce_timeout) PMIMPI_Reduce_timeout;
+extern __typeof__(MIMPI_Comm_size) PMIMPI_Comm_size;
+extern __typeof__(MIMPI_Comm_rank) PMIMPI_Comm_rank;
+extern __typeof__(MIMPI_Comm_split) PMIMPI_Comm_split;
+extern __typeof__(MIMPI_Comm_dup) PMIMPI_Comm_dup;
+extern __typeof__(MIMPI_Comm_free) PMIMPI_Comm_free;
+extern __typeof__(MIMPI_Comm_send) PMIMPI_Comm_send;
+extern __typeof__(MIMPI_Comm_recv) PMIMPI_Comm_recv;
+extern __typeof__(MIMPI_Comm_barrier) PMIMPI_Comm_barrier;
+extern __typeof__(MIMPI_Comm_bcast) PMIMPI_Comm_bcast;
+extern __typeof__(MIMPI_Comm_reduce) PMIMPI_Comm_reduce;
+
 #endif /* MIMPI_H */
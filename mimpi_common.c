@@ -15,12 +15,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
-#define START_GROUP_FD 800
-#define START_PP_FD 900
+// Descriptors of a process are laid out from FIRST_FD: the shared memory barrier, the broker's socket, the io_uring
+// instance, the table of waits, group channels for every tree position, and then point-to-point channels, packed for
+// the size of the world.
+#define FIRST_FD 20
+#define END_FD 1024
+#define SHARED_FD FIRST_FD
+#define BROKER_FD (FIRST_FD + 1)
+#define RING_FD (FIRST_FD + 2)
+#define WAIT_TABLE_FD (FIRST_FD + 3)
+#define START_GROUP_FD (FIRST_FD + 4)
 #define MAX_PATH_LENGTH 1024
 
 _Noreturn void syserr(const char* fmt, ...)
@@ -53,8 +62,117 @@ _Noreturn void fatal(const char* fmt, ...)
 /////////////////////////////////////////////////
 // Put your implementation here
 
+size_t shared_barrier_size (int size) {
+    return sizeof(shared_barrier_t) + size * sizeof(atomic_int);
+}
+
+size_t wait_table_size (int size) {
+    return size * sizeof(wait_slot_t) + size * size * sizeof(atomic_int);
+}
+
+int determine_shared (void) {
+    return SHARED_FD;
+}
+
+int determine_broker (void) {
+    return BROKER_FD;
+}
+
+int determine_ring (void) {
+    return RING_FD;
+}
+
+int determine_wait_table (void) {
+    return WAIT_TABLE_FD;
+}
+
+bool lazy_connect (void) {
+    const char* connect = getenv("MIMPI_CONNECT");
+    if (connect == NULL || strcmp(connect, "eager") == 0) {
+        return false;
+    }
+    if (strcmp(connect, "lazy") != 0) {
+        fatal("Unknown MIMPI_CONNECT: %s", connect);
+    }
+    return true;
+}
+
+bool packet_transport (void) {
+    const char* transport = getenv("MIMPI_TRANSPORT");
+    if (transport == NULL || strcmp(transport, "pipe") == 0) {
+        return false;
+    }
+    if (strcmp(transport, "seqpacket") != 0) {
+        fatal("Unknown MIMPI_TRANSPORT: %s", transport);
+    }
+    return true;
+}
+
+bool uring_io (void) {
+    const char* io = getenv("MIMPI_IO");
+    if (io == NULL || strcmp(io, "sync") == 0) {
+        return false;
+    }
+    if (strcmp(io, "uring") != 0) {
+        fatal("Unknown MIMPI_IO: %s", io);
+    }
+    return true;
+}
+
+// Sends a message with up to two descriptors attached.
+int broker_send (int fd, broker_message_t const* message, int const* fds, int fds_count) {
+    struct iovec iov = {.iov_base = (void*)message, .iov_len = sizeof(broker_message_t)};
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fds_count > 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(fds_count * sizeof(int));
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(fds_count * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, fds_count * sizeof(int));
+    }
+    return sendmsg(fd, &msg, MSG_NOSIGNAL);
+}
+
+// Receives a message, putting attached descriptors in fds (and -1 in place of missing ones).
+// Returns like recvmsg, so 0 means the other side has closed the socket.
+int broker_recv (int fd, broker_message_t* message, int* fds) {
+    struct iovec iov = {.iov_base = message, .iov_len = sizeof(broker_message_t)};
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    fds[0] = fds[1] = -1;
+    int ret = recvmsg(fd, &msg, 0);
+    if (ret <= 0) {
+        return ret;
+    }
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(fds, CMSG_DATA(cmsg), min(cmsg->cmsg_len - CMSG_LEN(0), 2 * sizeof(int)));
+        }
+    }
+    return ret;
+}
+
+static int start_pp_fd;
+static int end_fd;
+
+int determine_end (void) {
+    return end_fd;
+}
+
 int determine_read (int read, int write) {
-    int ret_val = START_PP_FD + 2 * write;
+    int ret_val = start_pp_fd + 2 * write;
     if (write > read) {
         ret_val -= 2;
     }
@@ -65,11 +183,11 @@ int determine_write (int write, int read) {
     return determine_read(write, read) + 1;
 }
 
-int determine_gread (MIMPI_Tree pos) {
+int determine_gread (int pos) {
     return START_GROUP_FD + 2 * pos;
 }
 
-int determine_gwrite (MIMPI_Tree pos) {
+int determine_gwrite (int pos) {
     return START_GROUP_FD + 2 * pos + 1;
 }
 
@@ -89,14 +207,206 @@ int max(int a, int b) {
     }
 }
 
-int group_num (int rank, MIMPI_Tree pos) {
-    if (pos == MIMPI_Father) {
-        return ((rank + 1) / 2) - 1;
-    } else if (pos == MIMPI_Left) {
-        return 2 * rank + 1;
+static int group_size;
+static MIMPI_Topology topology = MIMPI_Kary;
+static int fanout = 2;
+// Processes are spread over hosts (set by mimpirun in MIMPI_HOST_COUNT) in consecutive blocks.
+static int hosts = 1;
+
+int host_count (void) {
+    return hosts;
+}
+
+int host_first (int host) {
+    return (int)((long)host * group_size / hosts);
+}
+
+int host_of (int rank) {
+    int host = 0;
+    while (host_first(host + 1) <= rank) {
+        host++;
+    }
+    return host;
+}
+
+void group_init (int size) {
+    group_size = size;
+    const char* tree = getenv("MIMPI_TREE");
+    if (tree == NULL || strcmp(tree, "binary") == 0) {
+        topology = MIMPI_Kary;
+        fanout = 2;
+    } else if (strcmp(tree, "kary") == 0) {
+        topology = MIMPI_Kary;
+        const char* fanout_str = getenv("MIMPI_TREE_FANOUT");
+        long wanted = fanout_str == NULL ? 2 : strtol(fanout_str, NULL, 0);
+        if (wanted < 1) {
+            fatal("Invalid MIMPI_TREE_FANOUT: %s", fanout_str);
+        }
+        // No process has more than size - 1 children anyway, and a smaller fanout keeps ranks of children in range.
+        fanout = (int)(wanted < size - 1 ? wanted : max(size - 1, 1));
+    } else if (strcmp(tree, "binomial") == 0) {
+        topology = MIMPI_Binomial;
+    } else if (strcmp(tree, "flat") == 0) {
+        topology = MIMPI_Flat;
     } else {
-        return 2 * rank + 2;
+        fatal("Unknown MIMPI_TREE: %s", tree);
+    }
+    const char* host_count_str = getenv("MIMPI_HOST_COUNT");
+    hosts = host_count_str == NULL ? 1 : strtol(host_count_str, NULL, 0);
+    if (hosts < 1 || hosts > size) {
+        fatal("Can't spread %d processes over %s hosts", size, host_count_str);
+    }
+    start_pp_fd = START_GROUP_FD + 2 * group_positions();
+    end_fd = start_pp_fd + 2 * (size - 1);
+    if (end_fd > END_FD) {
+        fatal("Descriptors %d-%d can't fit channels of %d processes", FIRST_FD, END_FD - 1, size);
+    }
+}
+
+// Lowest set bit of index, which bounds its children in a binomial tree of count members (the root has no bound).
+static int binomial_span (int index, int count) {
+    if (index == 0) {
+        int span = 1;
+        while (span < count) {
+            span *= 2;
+        }
+        return span;
+    }
+    return index & -index;
+}
+
+// Father of member index in a tree of the selected shape, or -1 for the root.
+static int shape_father (int index) {
+    if (index == 0) {
+        return -1;
+    }
+    switch (topology) {
+        case MIMPI_Kary:
+            return (index - 1) / fanout;
+        case MIMPI_Binomial:
+            return index - (index & -index);
+        case MIMPI_Flat:
+            return 0;
+    }
+    return -1;
+}
+
+// The child-th child of member index in a tree of the selected shape over count members, or -1 if there is none.
+static int shape_child (int index, int child, int count) {
+    int ret_val = count;
+    switch (topology) {
+        case MIMPI_Kary:
+            if (child < fanout) {
+                ret_val = fanout * index + 1 + child;
+            }
+            break;
+        case MIMPI_Binomial:
+            if (child < 31 && (1 << child) < binomial_span(index, count)) {
+                ret_val = index + (1 << child);
+            }
+            break;
+        case MIMPI_Flat:
+            if (index == 0) {
+                ret_val = 1 + child;
+            }
+            break;
+    }
+    return ret_val < count ? ret_val : -1;
+}
+
+// Most children a member may have in a tree of the selected shape over count members.
+static int shape_children_bound (int count) {
+    int children = 0;
+    switch (topology) {
+        case MIMPI_Kary:
+            children = fanout;
+            break;
+        case MIMPI_Binomial:
+            while ((1 << children) < count) {
+                children++;
+            }
+            break;
+        case MIMPI_Flat:
+            children = max(count - 1, 0);
+            break;
+    }
+    return children;
+}
+
+// Children of a leader are its children within the host, followed by leaders of its children among hosts.
+static int hierarchical_num (int rank, int pos) {
+    int host = host_of(rank);
+    int first = host_first(host);
+    int local = rank - first;
+    int locals = host_first(host + 1) - first;
+    if (pos == MIMPI_Father) {
+        if (local > 0) {
+            return first + shape_father(local);
+        }
+        int leader = shape_father(host);
+        return leader < 0 ? -1 : host_first(leader);
+    }
+    int child = pos - MIMPI_Child;
+    int local_children = 0;
+    while (shape_child(local, local_children, locals) >= 0) {
+        local_children++;
+    }
+    if (child < local_children) {
+        return first + shape_child(local, child, locals);
+    }
+    if (local > 0) {
+        return -1;
+    }
+    int leader = shape_child(host, child - local_children, hosts);
+    return leader < 0 ? -1 : host_first(leader);
+}
+
+// Returns the rank at position pos (MIMPI_Father or MIMPI_Child + i) of rank, or -1 if there is none.
+int group_num (int rank, int pos) {
+    if (hosts > 1) {
+        return hierarchical_num(rank, pos);
+    }
+    if (pos == MIMPI_Father) {
+        return shape_father(rank);
+    }
+    return shape_child(rank, pos - MIMPI_Child, group_size);
+}
+
+int group_children (int rank) {
+    int children = 0;
+    while (group_num(rank, MIMPI_Child + children) >= 0) {
+        children++;
+    }
+    return children;
+}
+
+// Number of positions any rank may use, i.e. the father and the biggest possible set of children.
+int group_positions (void) {
+    if (hosts == 1) {
+        return MIMPI_Child + shape_children_bound(group_size);
+    }
+    int locals = 0;
+    for (int host = 0; host < hosts; ++host) {
+        locals = max(locals, host_first(host + 1) - host_first(host));
+    }
+    return MIMPI_Child + shape_children_bound(locals) + shape_children_bound(hosts);
+}
+
+// Returns the index of the child of rank whose subtree contains target, or -1 if there is none.
+int group_subtree_child (int rank, int target) {
+    int father;
+    while (target > 0 && (father = group_num(target, MIMPI_Father)) != rank) {
+        target = father;
+    }
+    if (target <= 0) {
+        return -1;
+    }
+    for (int i = 0; i < group_children(rank); ++i) {
+        if (group_num(rank, MIMPI_Child + i) == target) {
+            return i;
+        }
     }
+    return -1;
 }
 
 
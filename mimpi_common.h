@@ -7,7 +7,9 @@
 #define MIMPI_COMMON_H
 
 #include <assert.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdnoreturn.h>
 
 /*
@@ -48,21 +50,109 @@ _Noreturn extern void fatal(const char* fmt, ...);
 /////////////////////////////////////////////
 // Put your declarations here
 
+// Position of a neighbour in the collective tree: the father, or the i-th child at MIMPI_Child + i.
 typedef enum {
     MIMPI_Father = 0,
-    MIMPI_Left = 1,
-    MIMPI_Right = 2
+    MIMPI_Child = 1
 } MIMPI_Tree;
 
+// Shape of the collective tree, selected at launch with MIMPI_TREE (and MIMPI_TREE_FANOUT for kary).
+// Processes on several hosts use a tree of two levels of that shape: one among processes of every host, whose first
+// process is its leader, and one among leaders, so that only leaders talk over the network.
+typedef enum {
+    MIMPI_Kary,
+    MIMPI_Binomial,
+    MIMPI_Flat
+} MIMPI_Topology;
+
+// Shared memory segment created by mimpirun for the shared memory barrier (MIMPI_BARRIER=shm).
+// wake is the futex word, bumped whenever a barrier is released or a process finishes.
+typedef struct {
+    atomic_int arrived;
+    atomic_int sense;
+    atomic_int wake;
+    atomic_int finished[];
+} shared_barrier_t;
+
+// Shared memory table created by mimpirun when all processes run on one host, on which deadlock detection
+// publishes waits. It holds a slot for every process, written only by that process except for doomed and
+// released, followed by sent[i * size + j], the number of user messages process i has sent to process j.
+// epoch is odd while a wait is being published, and even (twice the number of waits) once it is.
+typedef struct {
+    atomic_int epoch;
+    atomic_int kind;
+    atomic_int source;
+    atomic_int received;   // user messages received from the source and found not to match
+    atomic_int collective; // collectives entered, including nonblocking ones the progress thread has yet to run
+    atomic_int doomed;     // epoch of a wait found in a cycle
+    atomic_int released;   // epoch of a wait that may end, once everyone in its cycle is doomed
+    atomic_int padding[9];
+} wait_slot_t;
+
+// Messages exchanged with the connection broker, which mimpirun runs with MIMPI_CONNECT=lazy.
+// Processes ask for channels with a peer before their first message to it; the broker sends
+// both of them their read and write ends, or tells the asking one that the peer has already finished.
+typedef enum {
+    MIMPI_Broker_Connect,
+    MIMPI_Broker_Finished
+} MIMPI_Broker_Kind;
+
+typedef struct {
+    MIMPI_Broker_Kind kind;
+    int peer;
+} broker_message_t;
+
+bool lazy_connect(void);
+
+// Point-to-point channels inside a host are pipes, or with MIMPI_TRANSPORT=seqpacket sockets of
+// type SOCK_SEQPACKET, over which every message (or every fragment of a long one) is a single packet.
+bool packet_transport(void);
+
+// With MIMPI_IO=uring, packets of a message to a process on the same host are sent through io_uring.
+// Only packet channels can be, so with pipes it has no effect.
+bool uring_io(void);
+
+int broker_send(int fd, broker_message_t const* message, int const* fds, int fds_count);
+
+int broker_recv(int fd, broker_message_t* message, int* fds);
+
+size_t shared_barrier_size(int size);
+
+size_t wait_table_size(int size);
+
+int determine_shared(void);
+
+int determine_broker(void);
+
+int determine_ring(void);
+
+int determine_wait_table(void);
+
+int determine_end(void);
+
 int determine_read(int read, int write);
 
 int determine_write(int write, int read);
 
-int determine_gread(MIMPI_Tree pos);
+int determine_gread(int pos);
+
+int determine_gwrite(int pos);
+
+void group_init(int size);
+
+int group_num(int rank, int pos);
+
+int group_children(int rank);
+
+int group_positions(void);
+
+int group_subtree_child(int rank, int target);
+
+int host_count(void);
 
-int determine_gwrite(MIMPI_Tree pos);
+int host_first(int host);
 
-int group_num(int rank, MIMPI_Tree pos);
+int host_of(int rank);
 
 int min(int a, int b);
 
@@ -0,0 +1,73 @@
+/**
+ * A sample profiling library for MIMPI programs: it counts calls of point-to-point operations
+ * and basic collectives, and the bytes they pass, and prints them in MIMPI_Finalize.
+ * Linked with a program, its MIMPI_ functions take the place of the weak ones of mimpi.c,
+ * and do the work through the PMIMPI_ ones.
+ * */
+
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "mimpi.h"
+
+typedef enum {
+    COUNT_SEND,
+    COUNT_RECV,
+    COUNT_BARRIER,
+    COUNT_BCAST,
+    COUNT_REDUCE,
+    COUNTED_FUNCTIONS,
+} counted_t;
+
+static char const* const counted_names[COUNTED_FUNCTIONS] = {
+    [COUNT_SEND] = "MIMPI_Send",
+    [COUNT_RECV] = "MIMPI_Recv",
+    [COUNT_BARRIER] = "MIMPI_Barrier",
+    [COUNT_BCAST] = "MIMPI_Bcast",
+    [COUNT_REDUCE] = "MIMPI_Reduce",
+};
+
+static atomic_llong calls[COUNTED_FUNCTIONS];
+static atomic_llong bytes[COUNTED_FUNCTIONS];
+
+static void count_call(counted_t function, int count) {
+    atomic_fetch_add_explicit(&calls[function], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&bytes[function], count, memory_order_relaxed);
+}
+
+MIMPI_Retcode MIMPI_Send(void const *data, int count, int destination, int tag) {
+    count_call(COUNT_SEND, count);
+    return PMIMPI_Send(data, count, destination, tag);
+}
+
+MIMPI_Retcode MIMPI_Recv(void *data, int count, int source, int tag) {
+    count_call(COUNT_RECV, count);
+    return PMIMPI_Recv(data, count, source, tag);
+}
+
+MIMPI_Retcode MIMPI_Barrier() {
+    count_call(COUNT_BARRIER, 0);
+    return PMIMPI_Barrier();
+}
+
+MIMPI_Retcode MIMPI_Bcast(void *data, int count, int root) {
+    count_call(COUNT_BCAST, count);
+    return PMIMPI_Bcast(data, count, root);
+}
+
+MIMPI_Retcode MIMPI_Reduce(void const *send_data, void *recv_data, int count, MIMPI_Op op, int root) {
+    count_call(COUNT_REDUCE, count);
+    return PMIMPI_Reduce(send_data, recv_data, count, op, root);
+}
+
+// Prints the counts as a single write, so that those of different processes don't interleave.
+void MIMPI_Finalize() {
+    char table[1024];
+    int length = 0;
+    for (int i = 0; i < COUNTED_FUNCTIONS; ++i) {
+        length += snprintf(table + length, sizeof(table) - length, "mimpi_count: rank %d %-13s %8lld calls %10lld bytes\n",
+                           PMIMPI_World_rank(), counted_names[i], atomic_load(&calls[i]), atomic_load(&bytes[i]));
+    }
+    fputs(table, stderr);
+    PMIMPI_Finalize();
+}
@@ -2,126 +2,609 @@
  * This file is for implementation of mimpirun program.
  * */
 
+#define _GNU_SOURCE
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/wait.h>
 #include "channel.h"
 
 #include "mimpi_common.h"
 
-int main(int argc, char *argv[]) {
-    long n = strtol(argv[1], NULL, 0);
-    char *prog = argv[2];
-    char* args[argc - 1];
-    pid_t pid;
-    for (int i = 2; i < argc; ++i) {
-        args[i - 2] = argv[i];
+static void raise_descriptor_limit(long n, bool lazy, struct rlimit* original) {
+    rlim_t needed = lazy ? 1024 + 6 * n : 1024 + n * n / 2 + 6 * n;
+    ASSERT_SYS_OK(getrlimit(RLIMIT_NOFILE, original));
+    struct rlimit limit = *original;
+    if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < needed) {
+        if (limit.rlim_max != RLIM_INFINITY && limit.rlim_max < needed) {
+            fatal("%ld processes need %lu descriptors, but RLIMIT_NOFILE is %lu%s", n, (unsigned long)needed,
+                  (unsigned long)limit.rlim_max, lazy ? "" : "; with MIMPI_CONNECT=lazy they need only about 6 each");
+        }
+        limit.rlim_cur = needed;
+        ASSERT_SYS_OK(setrlimit(RLIMIT_NOFILE, &limit));
     }
-    args[argc - 2] = NULL;
-    int fd[2];
-    int channels_point_point[n][n][2];
-    int channels_group[n][n][2];
-    char num[20];
-    sprintf(num, "%ld", n);
-    ASSERT_SYS_OK(setenv("MIMPI_SIZE", num, 0));
+}
+
+// Creates channels from process i to peer and back. A packet socket is both the read and the write end
+// of each side, duplicated so that every end can be closed on its own.
+static void pair_channels(bool packet, int to_peer[2], int to_i[2]) {
+    if (!packet) {
+        ASSERT_SYS_OK(channel(to_peer));
+        ASSERT_SYS_OK(channel(to_i));
+        return;
+    }
+    int sockets[2];
+    ASSERT_SYS_OK(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets));
+    to_i[0] = sockets[0];
+    ASSERT_SYS_OK(to_peer[1] = dup(sockets[0]));
+    to_peer[0] = sockets[1];
+    ASSERT_SYS_OK(to_i[1] = dup(sockets[1]));
+}
 
+// Sends channels between process i and peer to both of them, once for every pair.
+static void broker_connect(long n, struct pollfd* sockets, bool* connected, int i, int peer) {
+    broker_message_t message = {MIMPI_Broker_Finished, peer};
+    if (sockets[peer].fd < 0) {
+        broker_send(sockets[i].fd, &message, NULL, 0);
+        return;
+    }
+    if (connected[min(i, peer) * n + max(i, peer)]) {
+        return;
+    }
+    connected[min(i, peer) * n + max(i, peer)] = true;
+    int to_peer[2], to_i[2];
+    pair_channels(packet_transport(), to_peer, to_i);
+    int i_fds[2] = {to_i[0], to_peer[1]};
+    int peer_fds[2] = {to_peer[0], to_i[1]};
+    // Errors mean that the process has died, which the others learn when its socket is closed.
+    message.kind = MIMPI_Broker_Connect;
+    broker_send(sockets[i].fd, &message, i_fds, 2);
+    message.peer = i;
+    broker_send(sockets[peer].fd, &message, peer_fds, 2);
+    for (int j = 0; j < 2; ++j) {
+        ASSERT_SYS_OK(close(to_peer[j]));
+        ASSERT_SYS_OK(close(to_i[j]));
+    }
+}
+
+// Serves requests for channels until every process has closed its socket, which it does
+// in MIMPI_Finalize or by exiting. The others are then told it has finished.
+static void run_broker(long n, int* broker_sockets) {
+    struct pollfd* sockets = malloc(n * sizeof(struct pollfd));
+    bool* connected = calloc(n * n, sizeof(bool));
     for (int i = 0; i < n; ++i) {
-        if (group_num(i, MIMPI_Father) >= 0) {
-            ASSERT_SYS_OK(channel(fd));
-            channels_group[i][group_num(i, MIMPI_Father)][0] = fd[0];
-            channels_group[i][group_num(i, MIMPI_Father)][1] = fd[1];
-        }
-        if (group_num(i, MIMPI_Left) < n) {
-            ASSERT_SYS_OK(channel(fd));
-            channels_group[i][group_num(i, MIMPI_Left)][0] = fd[0];
-            channels_group[i][group_num(i, MIMPI_Left)][1] = fd[1];
+        sockets[i].fd = broker_sockets[i];
+        sockets[i].events = POLLIN;
+    }
+    int running = n;
+    while (running > 0) {
+        ASSERT_SYS_OK(poll(sockets, n, -1));
+        for (int i = 0; i < n; ++i) {
+            if (sockets[i].fd < 0 || sockets[i].revents == 0) {
+                continue;
+            }
+            broker_message_t message;
+            int fds[2];
+            if (broker_recv(sockets[i].fd, &message, fds) <= 0) {
+                ASSERT_SYS_OK(close(sockets[i].fd));
+                sockets[i].fd = -1;
+                running--;
+                message.kind = MIMPI_Broker_Finished;
+                message.peer = i;
+                for (int j = 0; j < n; ++j) {
+                    if (sockets[j].fd >= 0) {
+                        broker_send(sockets[j].fd, &message, NULL, 0);
+                    }
+                }
+            } else if (message.kind == MIMPI_Broker_Connect && message.peer >= 0 && message.peer < n && message.peer != i) {
+                broker_connect(n, sockets, connected, i, message.peer);
+            }
         }
-        if (group_num(i, MIMPI_Right) < n) {
-            ASSERT_SYS_OK(channel(fd));
-            channels_group[i][group_num(i, MIMPI_Right)][0] = fd[0];
-            channels_group[i][group_num(i, MIMPI_Right)][1] = fd[1];
+    }
+    free(connected);
+    free(sockets);
+}
+
+// Closes a descriptor held by the parent, unless it was closed already.
+static void close_held(int* fd) {
+    if (*fd >= 0) {
+        ASSERT_SYS_OK(close(*fd));
+        *fd = -1;
+    }
+}
+
+// Starts processes with ranks from first to last - 1 and waits for them. They are connected with each other by channels,
+// and (if remote_point_point and remote_group are given) with processes on other hosts by sockets, at [i * n + j]
+// for the socket of local process i to remote process j.
+static void launch(long n, int first, int last, int* remote_point_point, int* remote_group, char* prog, char** args,
+                   struct rlimit* original_limit) {
+    pid_t pid;
+    int fd[2];
+    // Channel from j to i is at [i * n + j].
+    int (*channels_point_point)[2] = malloc(n * n * sizeof(int[2]));
+    int (*channels_group)[2] = malloc(n * n * sizeof(int[2]));
+    int* broker_sockets = malloc(n * sizeof(int));
+    for (int i = 0; i < n * n; ++i) {
+        channels_point_point[i][0] = channels_point_point[i][1] = -1;
+        channels_group[i][0] = channels_group[i][1] = -1;
+    }
+    int positions = group_positions();
+    bool lazy = lazy_connect();
+    bool packet = packet_transport();
+    bool ring = packet && uring_io();
+    const char* barrier = getenv("MIMPI_BARRIER");
+    bool shared = barrier != NULL && strcmp(barrier, "shm") == 0;
+    if (shared) {
+        int shared_fd;
+        ASSERT_SYS_OK(shared_fd = memfd_create("mimpi_barrier", 0));
+        ASSERT_SYS_OK(ftruncate(shared_fd, shared_barrier_size(n)));
+        ASSERT_SYS_OK(dup2(shared_fd, determine_shared()));
+        ASSERT_SYS_OK(close(shared_fd));
+    }
+    // Processes on other hosts can't see this host's memory, so their deadlock detection sends probes instead.
+    bool table = remote_point_point == NULL;
+    if (table) {
+        int table_fd;
+        ASSERT_SYS_OK(table_fd = memfd_create("mimpi_wait_table", 0));
+        ASSERT_SYS_OK(ftruncate(table_fd, wait_table_size(n)));
+        ASSERT_SYS_OK(dup2(table_fd, determine_wait_table()));
+        ASSERT_SYS_OK(close(table_fd));
+    }
+
+    for (int i = first; i < last; ++i) {
+        for (int j = 0; j < positions; ++j) {
+            int neighbour = group_num(i, j);
+            if (neighbour >= first && neighbour < last) {
+                ASSERT_SYS_OK(channel(fd));
+                channels_group[i * n + neighbour][0] = fd[0];
+                channels_group[i * n + neighbour][1] = fd[1];
+            }
         }
     }
-    for (int i = 0; i < n; ++i) {
-        for (int j = i + 1; j < n; ++j) {
-            ASSERT_SYS_OK(channel(fd));
-            channels_point_point[i][j][0] = fd[0];
-            channels_point_point[i][j][1] = fd[1];
-            ASSERT_SYS_OK(channel(fd));
-            channels_point_point[j][i][0] = fd[0];
-            channels_point_point[j][i][1] = fd[1];
+    for (int i = first; i < last; ++i) {
+        int broker[2];
+        if (lazy) {
+            ASSERT_SYS_OK(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, broker));
+        }
+        for (int j = i + 1; j < last && !lazy; ++j) {
+            pair_channels(packet, channels_point_point[j * n + i], channels_point_point[i * n + j]);
         }
         ASSERT_SYS_OK(pid = fork());
         if (!pid) {
             char rank[20];
             sprintf(rank, "%d", i);
-            for (int j = 0; j < 3; ++j) {
-                if (group_num(i, j) >= 0 && group_num(i, j) < n) {
-                    ASSERT_SYS_OK(dup2(channels_group[i][group_num(i, j)][0], determine_gread(j)));
-                    ASSERT_SYS_OK(dup2(channels_group[group_num(i, j)][i][1], determine_gwrite(j)));
+            for (int j = 0; j < positions; ++j) {
+                int neighbour = group_num(i, j);
+                if (neighbour >= first && neighbour < last) {
+                    ASSERT_SYS_OK(dup2(channels_group[i * n + neighbour][0], determine_gread(j)));
+                    ASSERT_SYS_OK(dup2(channels_group[neighbour * n + i][1], determine_gwrite(j)));
+                } else if (neighbour >= 0) {
+                    ASSERT_SYS_OK(dup2(remote_group[i * n + neighbour], determine_gread(j)));
+                    ASSERT_SYS_OK(dup2(remote_group[i * n + neighbour], determine_gwrite(j)));
+                } else {
+                    ASSERT_SYS_OK(close(determine_gread(j)));
+                    ASSERT_SYS_OK(close(determine_gwrite(j)));
                 }
             }
+            if (!shared) {
+                ASSERT_SYS_OK(close(determine_shared()));
+            }
+            if (lazy) {
+                ASSERT_SYS_OK(dup2(broker[1], determine_broker()));
+                ASSERT_SYS_OK(close(broker[0]));
+                ASSERT_SYS_OK(close(broker[1]));
+                for (int j = first; j < i; ++j) {
+                    ASSERT_SYS_OK(close(broker_sockets[j]));
+                }
+            } else {
+                ASSERT_SYS_OK(close(determine_broker()));
+            }
+            // The ring takes the place of its placeholder in MIMPI_Init, which closes it if there's no ring.
+            if (!ring) {
+                ASSERT_SYS_OK(close(determine_ring()));
+            }
+            if (!table) {
+                ASSERT_SYS_OK(close(determine_wait_table()));
+            }
 
-            for (int j = 0; j < n; ++j) {
-                if (i != j) {
-                    //printf("test\n");
-                    //printf("assigned read from %d to %d to %d in process %d\n", j, i, determine_read(i, j), i);
-                    ASSERT_SYS_OK(dup2(channels_point_point[i][j][0], determine_read(i, j)));
-                    //printf("assigned write from %d to %d to %d in process %d\n", i, j, determine_write(i, j), i);
-                    ASSERT_SYS_OK(dup2(channels_point_point[j][i][1], determine_write(i, j)));
+            // Lazy channels arrive later, in place of the placeholders, which stay open until then.
+            for (int j = 0; j < n && !lazy; ++j) {
+                if (i != j && j >= first && j < last) {
+                    ASSERT_SYS_OK(dup2(channels_point_point[i * n + j][0], determine_read(i, j)));
+                    ASSERT_SYS_OK(dup2(channels_point_point[j * n + i][1], determine_write(i, j)));
+                } else if (i != j) {
+                    ASSERT_SYS_OK(dup2(remote_point_point[i * n + j], determine_read(i, j)));
+                    ASSERT_SYS_OK(dup2(remote_point_point[i * n + j], determine_write(i, j)));
                 }
             }
-            for (int j = i; j < n; ++j) {
-                for (int k = 0; k <= i; ++k) {
-                    if (j != k) {
-                        ASSERT_SYS_OK(close(channels_point_point[j][k][0]));
-                        ASSERT_SYS_OK(close(channels_point_point[j][k][1]));
-                        ASSERT_SYS_OK(close(channels_point_point[k][j][0]));
-                        ASSERT_SYS_OK(close(channels_point_point[k][j][1]));
+            for (int k = first; k < last; ++k) {
+                for (int j = 0; j < positions; ++j) {
+                    int neighbour = group_num(k, j);
+                    if (neighbour >= first && neighbour < last) {
+                        close_held(&channels_group[k * n + neighbour][0]);
+                        close_held(&channels_group[k * n + neighbour][1]);
                     }
                 }
             }
-            for (int j = 0; j < n; ++j) {
-                if (group_num(j, MIMPI_Father) >= 0) {
-                    ASSERT_SYS_OK(close(channels_group[j][group_num(j, MIMPI_Father)][0]));
-                    ASSERT_SYS_OK(close(channels_group[j][group_num(j, MIMPI_Father)][1]));                }
-                if (group_num(j, MIMPI_Left) < n) {
-                    ASSERT_SYS_OK(close(channels_group[j][group_num(j, MIMPI_Left)][0]));
-                    ASSERT_SYS_OK(close(channels_group[j][group_num(j, MIMPI_Left)][1]));
-                }
-                if (group_num(j, MIMPI_Right) < n) {
-                    ASSERT_SYS_OK(close(channels_group[j][group_num(j, MIMPI_Right)][0]));
-                    ASSERT_SYS_OK(close(channels_group[j][group_num(j, MIMPI_Right)][1]));
+            // Without the broker, the parent holds point-to-point channels of all processes still to start.
+            for (int j = 0; j < n * n && !lazy; ++j) {
+                close_held(&channels_point_point[j][0]);
+                close_held(&channels_point_point[j][1]);
+                if (remote_point_point != NULL) {
+                    close_held(&remote_point_point[j]);
+                    close_held(&remote_group[j]);
                 }
             }
+            ASSERT_SYS_OK(setrlimit(RLIMIT_NOFILE, original_limit));
             ASSERT_SYS_OK(setenv("MIMPI_RANK", rank, 0));
             ASSERT_SYS_OK(execvp(prog, args));
         }
-        for (int j = 0; j < i; ++j) {
-            ASSERT_SYS_OK(close(channels_point_point[i][j][0]));
-            ASSERT_SYS_OK(close(channels_point_point[i][j][1]));
-            ASSERT_SYS_OK(close(channels_point_point[j][i][0]));
-            ASSERT_SYS_OK(close(channels_point_point[j][i][1]));
+        if (lazy) {
+            ASSERT_SYS_OK(close(broker[1]));
+            broker_sockets[i] = broker[0];
+        }
+        for (int j = 0; j < n; ++j) {
+            if (j != i) {
+                close_held(&channels_point_point[i * n + j][0]);
+                close_held(&channels_point_point[j * n + i][1]);
+                if (remote_point_point != NULL) {
+                    close_held(&remote_point_point[i * n + j]);
+                    close_held(&remote_group[i * n + j]);
+                }
+            }
         }
     }
-    for (int j = 0; j < n; ++j) {
-        if (group_num(j, MIMPI_Father) >= 0) {
-            ASSERT_SYS_OK(close(channels_group[j][group_num(j, MIMPI_Father)][0]));
-            ASSERT_SYS_OK(close(channels_group[j][group_num(j, MIMPI_Father)][1]));                }
-        if (group_num(j, MIMPI_Left) < n) {
-            ASSERT_SYS_OK(close(channels_group[j][group_num(j, MIMPI_Left)][0]));
-            ASSERT_SYS_OK(close(channels_group[j][group_num(j, MIMPI_Left)][1]));
+    for (int j = 0; j < n * n; ++j) {
+        close_held(&channels_group[j][0]);
+        close_held(&channels_group[j][1]);
+    }
+    for (int fd = determine_shared(); fd < determine_end(); ++fd) {
+        ASSERT_SYS_OK(close(fd));
+    }
+    if (lazy) {
+        run_broker(last - first, broker_sockets + first);
+    }
+    free(channels_point_point);
+    free(channels_group);
+    free(broker_sockets);
+
+    for (int i = first; i < last; ++i) {
+        wait(NULL);
+    }
+}
+
+// Socket buffers of connections between hosts, big enough to keep a few large messages in flight.
+#define SOCKET_BUFFER (4 << 20)
+
+struct connection_header {
+    int from;
+    int to;
+    bool group;
+};
+
+static void read_all(int fd, void* data, size_t count) {
+    size_t done = 0;
+    while (done < count) {
+        ssize_t bytes_read;
+        ASSERT_SYS_OK(bytes_read = read(fd, data + done, count - done));
+        if (bytes_read == 0) {
+            fatal("Unexpected end of file while starting hosts");
         }
-        if (group_num(j, MIMPI_Right) < n) {
-            ASSERT_SYS_OK(close(channels_group[j][group_num(j, MIMPI_Right)][0]));
-            ASSERT_SYS_OK(close(channels_group[j][group_num(j, MIMPI_Right)][1]));
+        done += bytes_read;
+    }
+}
+
+static void write_all(int fd, void const* data, size_t count) {
+    size_t done = 0;
+    while (done < count) {
+        ssize_t bytes_written;
+        ASSERT_SYS_OK(bytes_written = write(fd, data + done, count - done));
+        done += bytes_written;
+    }
+}
+
+static void tune_socket(int fd) {
+    int one = 1;
+    int buffer = SOCKET_BUFFER;
+    ASSERT_SYS_OK(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)));
+    ASSERT_SYS_OK(setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer)));
+    ASSERT_SYS_OK(setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer)));
+}
+
+// Whether local process i and remote process j talk over a socket of the given kind, which then
+// is to be connected by the host with the lower number.
+static bool remote_pair(int i, int j, bool group) {
+    if (host_of(i) == host_of(j)) {
+        return false;
+    }
+    if (!group) {
+        return true;
+    }
+    return group_num(i, MIMPI_Father) == j || group_num(j, MIMPI_Father) == i;
+}
+
+// Runs the processes of one host. The agent tells the coordinator where it listens, learns where the others do,
+// connects to hosts with higher numbers and accepts connections from lower ones, one per pair of processes.
+static void run_agent(long n, int host, int from_coordinator, int to_coordinator, char* prog, char** args,
+                      struct rlimit* original_limit) {
+    int hosts = host_count();
+    int first = host_first(host);
+    int last = host_first(host + 1);
+    int listener;
+    ASSERT_SYS_OK(listener = socket(AF_INET, SOCK_STREAM, 0));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    ASSERT_SYS_OK(bind(listener, (struct sockaddr*)&address, sizeof(address)));
+    ASSERT_SYS_OK(listen(listener, SOMAXCONN));
+    socklen_t length = sizeof(address);
+    ASSERT_SYS_OK(getsockname(listener, (struct sockaddr*)&address, &length));
+    write_all(to_coordinator, &address, sizeof(address));
+    struct sockaddr_in* endpoints = malloc(hosts * sizeof(struct sockaddr_in));
+    read_all(from_coordinator, endpoints, hosts * sizeof(struct sockaddr_in));
+    ASSERT_SYS_OK(close(from_coordinator));
+    ASSERT_SYS_OK(close(to_coordinator));
+
+    int* remote[2];
+    for (int kind = 0; kind < 2; ++kind) {
+        remote[kind] = malloc(n * n * sizeof(int));
+        for (int i = 0; i < n * n; ++i) {
+            remote[kind][i] = -1;
         }
     }
+    int expected = 0;
+    for (int i = first; i < last; ++i) {
+        for (int j = 0; j < n; ++j) {
+            for (int kind = 0; kind < 2; ++kind) {
+                if (!remote_pair(i, j, kind)) {
+                    continue;
+                }
+                if (host_of(j) < host) {
+                    expected++;
+                    continue;
+                }
+                int fd;
+                ASSERT_SYS_OK(fd = socket(AF_INET, SOCK_STREAM, 0));
+                tune_socket(fd);
+                ASSERT_SYS_OK(connect(fd, (struct sockaddr*)&endpoints[host_of(j)], sizeof(struct sockaddr_in)));
+                struct connection_header header = {i, j, kind};
+                write_all(fd, &header, sizeof(header));
+                remote[kind][i * n + j] = fd;
+            }
+        }
+    }
+    for (; expected > 0; --expected) {
+        int fd;
+        ASSERT_SYS_OK(fd = accept(listener, NULL, NULL));
+        tune_socket(fd);
+        struct connection_header header;
+        read_all(fd, &header, sizeof(header));
+        remote[header.group][header.to * n + header.from] = fd;
+    }
+    ASSERT_SYS_OK(close(listener));
+    free(endpoints);
 
-    for (int i = 0; i < n; ++i) {
+    launch(n, first, last, remote[0], remote[1], prog, args, original_limit);
+    free(remote[0]);
+    free(remote[1]);
+}
+
+// Starts an agent for every host and passes around the endpoints they listen on.
+// Agents are local processes here; on a cluster each would be started on its host.
+static void run_hosts(long n, char* prog, char** args, struct rlimit* original_limit) {
+    int hosts = host_count();
+    int* to_agents = malloc(hosts * sizeof(int));
+    int* from_agents = malloc(hosts * sizeof(int));
+    for (int host = 0; host < hosts; ++host) {
+        int to_agent[2], from_agent[2];
+        ASSERT_SYS_OK(pipe(to_agent));
+        ASSERT_SYS_OK(pipe(from_agent));
+        pid_t pid;
+        ASSERT_SYS_OK(pid = fork());
+        if (!pid) {
+            for (int j = 0; j < host; ++j) {
+                ASSERT_SYS_OK(close(to_agents[j]));
+                ASSERT_SYS_OK(close(from_agents[j]));
+            }
+            ASSERT_SYS_OK(close(to_agent[1]));
+            ASSERT_SYS_OK(close(from_agent[0]));
+            free(to_agents);
+            free(from_agents);
+            run_agent(n, host, to_agent[0], from_agent[1], prog, args, original_limit);
+            exit(0);
+        }
+        ASSERT_SYS_OK(close(to_agent[0]));
+        ASSERT_SYS_OK(close(from_agent[1]));
+        to_agents[host] = to_agent[1];
+        from_agents[host] = from_agent[0];
+    }
+    for (int fd = determine_shared(); fd < determine_end(); ++fd) {
+        ASSERT_SYS_OK(close(fd));
+    }
+    struct sockaddr_in* endpoints = malloc(hosts * sizeof(struct sockaddr_in));
+    for (int host = 0; host < hosts; ++host) {
+        read_all(from_agents[host], &endpoints[host], sizeof(struct sockaddr_in));
+        ASSERT_SYS_OK(close(from_agents[host]));
+    }
+    for (int host = 0; host < hosts; ++host) {
+        write_all(to_agents[host], endpoints, hosts * sizeof(struct sockaddr_in));
+        ASSERT_SYS_OK(close(to_agents[host]));
+    }
+    free(endpoints);
+    free(to_agents);
+    free(from_agents);
+    for (int host = 0; host < hosts; ++host) {
         wait(NULL);
     }
+}
+
+static void write_matrix(FILE* file, char const* title, long n, long long const* matrix) {
+    fprintf(file, "# %s, a row for every sender\n", title);
+    for (long i = 0; i < n; ++i) {
+        for (long j = 0; j < n; ++j) {
+            fprintf(file, j == 0 ? "%lld" : " %lld", matrix[i * n + j]);
+        }
+        fprintf(file, "\n");
+    }
+}
+
+// Merges the counters that processes left in MIMPI_STATS into its file matrix. A process that didn't
+// reach MIMPI_Finalize has left none, and its row stays empty.
+static void merge_stats(long n, char const* dir) {
+    long long* messages = calloc(n * n, sizeof(long long));
+    long long* bytes = calloc(n * n, sizeof(long long));
+    char path[PATH_MAX];
+    char line[256];
+    for (long i = 0; i < n; ++i) {
+        snprintf(path, sizeof(path), "%s/rank%ld", dir, i);
+        FILE* file = fopen(path, "r");
+        if (file == NULL) {
+            continue;
+        }
+        while (fgets(line, sizeof(line), file) != NULL) {
+            int j;
+            long long sent_messages, sent_bytes;
+            if (sscanf(line, "peer %d %lld %lld", &j, &sent_messages, &sent_bytes) == 3 && j >= 0 && j < n) {
+                messages[i * n + j] = sent_messages;
+                bytes[i * n + j] = sent_bytes;
+            }
+        }
+        fclose(file);
+    }
+    snprintf(path, sizeof(path), "%s/matrix", dir);
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        syserr("Can't write statistics to %s", path);
+    }
+    write_matrix(file, "messages sent", n, messages);
+    write_matrix(file, "bytes sent", n, bytes);
+    if (fclose(file) != 0) {
+        syserr("Can't write statistics to %s", path);
+    }
+    free(messages);
+    free(bytes);
+}
+
+// Merges the events that processes left in MIMPI_TRACE into its file trace.json, in the Chrome trace format
+// that chrome://tracing and Perfetto open: a process for every rank, with a track for every thread.
+static void merge_trace(long n, char const* dir) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/trace.json", dir);
+    FILE* out = fopen(path, "w");
+    if (out == NULL) {
+        syserr("Can't write trace to %s", path);
+    }
+    fprintf(out, "{\"traceEvents\":[\n");
+    bool first = true;
+    char line[256];
+    char name[128];
+    for (long i = 0; i < n; ++i) {
+        snprintf(path, sizeof(path), "%s/trace%ld", dir, i);
+        FILE* file = fopen(path, "r");
+        if (file == NULL) {
+            continue;
+        }
+        fprintf(out, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%ld,\"args\":{\"name\":\"rank %ld\"}}",
+                first ? "" : ",\n", i, i);
+        first = false;
+        while (fgets(line, sizeof(line), file) != NULL) {
+            char phase;
+            int thread, from, tag, count;
+            long long time;
+            if (sscanf(line, "T %d %127[^\n]", &thread, name) == 2) {
+                fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%d,"
+                        "\"args\":{\"name\":\"%s\"}}", i, thread, name);
+            } else if (sscanf(line, "%c %d %lld %127s %d %d %d", &phase, &thread, &time, name, &from, &tag, &count) >= 4) {
+                fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lld.%03lld,\"pid\":%ld,\"tid\":%d",
+                        name, phase == 'I' ? 'i' : phase, time / 1000, time % 1000, i, thread);
+                if (phase == 'I') {
+                    fprintf(out, ",\"s\":\"t\",\"args\":{\"from\":%d,\"tag\":%d,\"count\":%d}", from, tag, count);
+                }
+                fprintf(out, "}");
+            }
+        }
+        fclose(file);
+    }
+    fprintf(out, "\n]}\n");
+    if (fclose(out) != 0) {
+        syserr("Can't write trace to %s", path);
+    }
+}
+
+// Usage: mimpirun [--hosts HOST,...] n prog [args...]
+// The list of hosts may also be given in MIMPI_HOSTS. Processes are spread over hosts in consecutive blocks.
+int main(int argc, char *argv[]) {
+    const char* host_list = getenv("MIMPI_HOSTS");
+    if (argc > 2 && strcmp(argv[1], "--hosts") == 0) {
+        host_list = argv[2];
+        argv += 2;
+        argc -= 2;
+    }
+    long n = strtol(argv[1], NULL, 0);
+    char *prog = argv[2];
+    char* args[argc - 1];
+    for (int i = 2; i < argc; ++i) {
+        args[i - 2] = argv[i];
+    }
+    args[argc - 2] = NULL;
+    char num[20];
+    sprintf(num, "%ld", n);
+    ASSERT_SYS_OK(setenv("MIMPI_SIZE", num, 0));
+    int hosts = 1;
+    if (host_list != NULL && *host_list != '\0') {
+        for (const char* c = host_list; *c != '\0'; ++c) {
+            hosts += *c == ',';
+        }
+    }
+    sprintf(num, "%d", hosts);
+    ASSERT_SYS_OK(setenv("MIMPI_HOST_COUNT", num, 1));
+    group_init(n);
+    bool lazy = lazy_connect();
+    const char* barrier = getenv("MIMPI_BARRIER");
+    if (hosts > 1 && (lazy || (barrier != NULL && strcmp(barrier, "shm") == 0))) {
+        fatal("MIMPI_CONNECT=lazy and MIMPI_BARRIER=shm work only on a single host");
+    }
+    // Checked here too, so that a bad MIMPI_IO is reported once, before any process starts.
+    if (uring_io() && !packet_transport()) {
+        fprintf(stderr, "WARNING: MIMPI_IO=uring has no effect without MIMPI_TRANSPORT=seqpacket\n");
+    }
+    // Without the broker, the parent holds the ends of channels of every process not yet running, which connect it
+    // to the processes already running. For big worlds that's far beyond the usual limit of descriptors.
+    struct rlimit original_limit;
+    raise_descriptor_limit(n, lazy, &original_limit);
+    // Descriptors the children use are kept taken, so that no channel is created there and overwritten by dup2.
+    int placeholder[2];
+    ASSERT_SYS_OK(pipe(placeholder));
+    for (int fd = determine_shared(); fd < determine_end(); ++fd) {
+        ASSERT_SYS_OK(dup2(placeholder[0], fd));
+    }
+    ASSERT_SYS_OK(close(placeholder[0]));
+    ASSERT_SYS_OK(close(placeholder[1]));
+
+    if (hosts > 1) {
+        run_hosts(n, prog, args, &original_limit);
+    } else {
+        launch(n, 0, n, NULL, NULL, prog, args, &original_limit);
+    }
+    char const* stats = getenv("MIMPI_STATS");
+    if (stats != NULL && *stats != '\0') {
+        merge_stats(n, stats);
+    }
+    char const* trace = getenv("MIMPI_TRACE");
+    if (trace != NULL && *trace != '\0') {
+        merge_trace(n, trace);
+    }
 
     return 0;
-}
\ No newline at end of file
+}
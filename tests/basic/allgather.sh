@@ -0,0 +1,4 @@
+set -ex
+for n in 1 2 3 7 16 ; do
+    ./run_test 2 $n examples_build/allgather
+done
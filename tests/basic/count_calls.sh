@@ -0,0 +1,10 @@
+set -ex
+# The sample profiling library counts the program's calls, but not those that timed calls make inside MIMPI.
+./run_test 2 3 counted_build/timeout
+out=$(mktemp)
+timeout 2 ./mimpirun 3 counted_build/timeout 2> $out
+test $(grep -c '<<success>>' $out) -eq 3
+grep -Eq "^mimpi_count: rank 0 MIMPI_Send +2 calls +2 bytes$" $out
+grep -Eq "^mimpi_count: rank 0 MIMPI_Recv +1 calls +1 bytes$" $out
+grep -Eq "^mimpi_count: rank 2 MIMPI_Barrier +0 calls" $out
+rm $out
@@ -0,0 +1,8 @@
+set -ex
+for n in 2 3 5 8 ; do
+    ./run_test 2 $n examples_build/deadlock_cycle
+done
+MIMPI_BARRIER=dissemination ./run_test 2 5 examples_build/deadlock_cycle
+MIMPI_CONNECT=lazy ./run_test 2 5 examples_build/deadlock_cycle
+MIMPI_HOSTS=a,b ./run_test 2 4 examples_build/deadlock_cycle
+MIMPI_HOSTS=a,b ./run_test 2 3 examples_build/deadlock_cycle
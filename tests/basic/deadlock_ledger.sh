@@ -0,0 +1,7 @@
+set -ex
+# Across hosts deadlocks are found by probes, which check sent messages against a ledger of LEDGER_SLOTS per peer.
+for n in 3 6 ; do
+    CHANNELS_READ_DELAY=2 MIMPI_HOSTS=a,b ./run_test 5 $n examples_build/deadlock_ledger
+    MIMPI_HOSTS=a,b ./run_test 5 $n examples_build/deadlock_ledger
+    ./run_test 5 $n examples_build/deadlock_ledger
+done
@@ -0,0 +1,12 @@
+set -ex
+for tree in binary binomial flat ; do
+    for i in 0 1 6 15 ; do
+        MIMPI_TREE=$tree ./run_test 2 16 examples_build/gather_scatter $i
+    done
+    MIMPI_TREE=$tree ./run_test 2 1 examples_build/gather_scatter 0
+    MIMPI_TREE=$tree ./run_test 2 5 examples_build/gather_scatter 4
+done
+for i in 0 3 6 ; do
+    ./run_test 2 7 examples_build/gather_scatter $i
+done
+MIMPI_HOSTS=a,b ./run_test 2 7 examples_build/gather_scatter 5
@@ -0,0 +1,13 @@
+set -ex
+for n in 2 3 5 ; do
+    ./run_test 2 $n examples_build/latency
+done
+MIMPI_HOSTS=a,b ./run_test 2 4 examples_build/latency
+
+# Every process prints its table in MIMPI_Finalize.
+out=$(mktemp)
+MIMPI_LATENCY=1 timeout 2 ./mimpirun 3 examples_build/latency 2> $out
+test $(grep -c '<<success>>' $out) -eq 3
+grep -q "^rank 2 latency" $out
+test $(grep -c "^  recv match " $out) -eq 3
+rm $out
@@ -0,0 +1,12 @@
+set -ex
+export MIMPI_CONNECT=lazy
+for n in 2 5 16 ; do
+    ./run_test 2 $n examples_build/send_recv
+    ./run_test 2 $n examples_build/comm_split
+    ./run_test 2 $n examples_build/nonblocking
+    ./run_test 2 $n examples_build/alltoall
+    ./run_test 2 $n examples_build/open_files
+done
+./run_test 1 4 examples_build/recv_remote_finish
+./run_test 4s 10 examples_build/send_remote_finish
+./run_test 5 150 examples_build/hello
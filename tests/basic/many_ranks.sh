@@ -0,0 +1,11 @@
+set -ex
+for n in 64 100 ; do
+    ./run_test 10 $n examples_build/hello
+    ./run_test 10 $n examples_build/broadcast1 $((n - 1))
+    ./run_test 10 $n examples_build/nonblocking
+    MIMPI_TREE=flat ./run_test 10 $n examples_build/comm_split
+done
+# Eager channels need about n^2/2 descriptors in mimpirun, more than usual limits allow at 256 ranks.
+MIMPI_CONNECT=lazy ./run_test 10 256 examples_build/hello
+MIMPI_CONNECT=lazy ./run_test 10 256 examples_build/broadcast1 255
+MIMPI_CONNECT=lazy ./run_test 10 256 examples_build/nonblocking
@@ -0,0 +1,24 @@
+set -ex
+for hosts in a,b a,b,c ; do
+    export MIMPI_HOSTS=$hosts
+    for n in 4 9 ; do
+        ./run_test 2 $n examples_build/send_recv
+        ./run_test 2 $n examples_build/comm_split
+        ./run_test 2 $n examples_build/nonblocking
+        ./run_test 2 $n examples_build/alltoall
+        ./run_test 2 $n examples_build/reduce $((n - 1))
+    done
+    ./run_test 1 4 examples_build/recv_remote_finish
+    ./run_test 4s 10 examples_build/send_remote_finish
+done
+export MIMPI_HOSTS=a,b
+./run_test 2 2 examples_build/big_message
+unset MIMPI_HOSTS
+./mimpirun --hosts a,b 6 examples_build/hello > /dev/null
+
+# Both levels of the tree take the shape chosen with MIMPI_TREE.
+for tree in binomial flat kary ; do
+    MIMPI_TREE=$tree MIMPI_TREE_FANOUT=3 MIMPI_HOSTS=a,b,c ./run_test 2 7 examples_build/broadcast1 4
+    MIMPI_TREE=$tree MIMPI_TREE_FANOUT=3 MIMPI_HOSTS=a,b,c ./run_test 2 7 examples_build/reduce 6
+    MIMPI_TREE=$tree MIMPI_HOSTS=a,b ./run_test 2 9 examples_build/gather_scatter 3
+done
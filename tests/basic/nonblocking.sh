@@ -0,0 +1,6 @@
+set -ex
+for n in 1 2 3 6 16 ; do
+    ./run_test 2 $n examples_build/nonblocking
+    MIMPI_BARRIER=dissemination ./run_test 2 $n examples_build/nonblocking
+    MIMPI_BARRIER=shm ./run_test 2 $n examples_build/nonblocking
+done
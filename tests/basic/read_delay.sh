@@ -0,0 +1,5 @@
+set -ex
+# Reads are charged for every 512 bytes they ask for, so small messages must not ask for more.
+CHANNELS_READ_DELAY=10 ./run_test 1 2 examples_build/send_recv
+CHANNELS_READ_DELAY=10 MIMPI_HOSTS=a,b ./run_test 1 2 examples_build/send_recv
+CHANNELS_READ_DELAY=10 MIMPI_TRANSPORT=seqpacket ./run_test 1 2 examples_build/send_recv
@@ -0,0 +1,13 @@
+set -ex
+export MIMPI_TRANSPORT=seqpacket
+for n in 2 5 16 ; do
+    ./run_test 2 $n examples_build/send_recv
+    ./run_test 2 $n examples_build/comm_split
+    ./run_test 2 $n examples_build/alltoall
+    ./run_test 2 $n examples_build/allgather
+done
+./run_test 1 4 examples_build/recv_remote_finish
+./run_test 4s 10 examples_build/send_remote_finish
+./run_test 2 2 examples_build/big_message
+MIMPI_CONNECT=lazy ./run_test 2 16 examples_build/alltoall
+MIMPI_HOSTS=a,b ./run_test 2 9 examples_build/send_recv
@@ -0,0 +1,14 @@
+set -ex
+for n in 1 2 3 5 ; do
+    ./run_test 2 $n examples_build/stats
+done
+MIMPI_TRANSPORT=seqpacket ./run_test 2 4 examples_build/stats
+MIMPI_HOSTS=a,b ./run_test 2 4 examples_build/stats
+
+# Every process leaves its counters, and mimpirun merges what they sent into a matrix.
+dir=$(mktemp -d)
+MIMPI_STATS=$dir ./run_test 2 3 examples_build/stats
+test -f $dir/rank0 -a -f $dir/rank2
+grep -qx "0 3 0" $dir/matrix
+grep -qx "0 60 0" $dir/matrix
+rm -r $dir
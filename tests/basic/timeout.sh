@@ -0,0 +1,13 @@
+set -ex
+for n in 2 3 6 ; do
+    ./run_test 5 $n examples_build/timeout
+    MIMPI_BARRIER=dissemination ./run_test 5 $n examples_build/timeout
+    MIMPI_BARRIER=shm ./run_test 5 $n examples_build/timeout
+    for tree in binary binomial flat ; do
+        MIMPI_TREE=$tree ./run_test 5 $n examples_build/timeout bcast
+        MIMPI_TREE=$tree ./run_test 5 $n examples_build/timeout reduce
+    done
+done
+MIMPI_HOSTS=a,b ./run_test 5 4 examples_build/timeout
+MIMPI_HOSTS=a,b ./run_test 5 4 examples_build/timeout bcast
+MIMPI_HOSTS=a,b ./run_test 5 4 examples_build/timeout reduce
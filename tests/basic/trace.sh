@@ -0,0 +1,11 @@
+set -ex
+# Every process leaves its events, and mimpirun merges them into one Chrome trace.
+dir=$(mktemp -d)
+MIMPI_TRACE=$dir ./run_test 2 3 examples_build/nonblocking
+test -f $dir/trace.json
+grep -q '"name":"rank 2"' $dir/trace.json
+grep -q '"name":"MIMPI_Ibcast","ph":"B"' $dir/trace.json
+grep -q '"name":"bcast","ph":"E"' $dir/trace.json
+grep -q '"name":"enqueue","ph":"i"' $dir/trace.json
+test $(grep -c '"ph":"B"' $dir/trace.json) -eq $(grep -c '"ph":"E"' $dir/trace.json)
+rm -r $dir
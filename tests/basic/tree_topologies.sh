@@ -0,0 +1,12 @@
+set -ex
+for tree in binary binomial flat kary ; do
+    for i in 0 5 15 ; do
+        MIMPI_TREE=$tree MIMPI_TREE_FANOUT=3 ./run_test 2 16 examples_build/broadcast1 $i
+        MIMPI_TREE=$tree MIMPI_TREE_FANOUT=3 ./run_test 2 16 examples_build/reduce $i
+    done
+    MIMPI_TREE=$tree MIMPI_TREE_FANOUT=3 ./run_test 2 5 examples_build/barrier
+done
+
+# A fanout beyond the world is clamped to it, so children's ranks can't overflow.
+MIMPI_TREE=kary MIMPI_TREE_FANOUT=3000000000 ./run_test 2 16 examples_build/reduce 5
+MIMPI_TREE=kary MIMPI_TREE_FANOUT=2147483647 ./run_test 2 16 examples_build/broadcast1 5
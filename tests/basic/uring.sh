@@ -0,0 +1,20 @@
+set -ex
+export MIMPI_TRANSPORT=seqpacket
+export MIMPI_IO=uring
+for n in 2 5 16 ; do
+    ./run_test 2 $n examples_build/send_recv
+    ./run_test 2 $n examples_build/alltoall
+    ./run_test 2 $n examples_build/nonblocking
+done
+./run_test 1 4 examples_build/recv_remote_finish
+./run_test 4s 10 examples_build/send_remote_finish
+./run_test 2 2 examples_build/big_message
+./run_test 2 5 examples_build/open_files
+# Where io_uring is disabled, packets are sent without the ring.
+for n in 2 5 ; do
+    ./run_test 2 $n no_uring_build/send_recv
+    ./run_test 2 $n no_uring_build/open_files
+done
+# Without packet channels there's nothing to send through the ring, which mimpirun warns about once.
+MIMPI_TRANSPORT=pipe ./run_test 2 3 examples_build/send_recv
+test "$(MIMPI_TRANSPORT=pipe timeout 2 ./mimpirun 3 examples_build/send_recv 2>&1 | grep -ac "MIMPI_IO=uring has no effect")" = 1
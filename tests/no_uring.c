@@ -0,0 +1,33 @@
+/**
+ * Linked into a MIMPI program, makes io_uring_setup fail as it does where io_uring is disabled
+ * (kernel.io_uring_disabled, seccomp), so that the fallback of MIMPI_IO=uring can be tested.
+ * Every other system call is passed on to the one of libc.
+ * */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <sys/syscall.h>
+
+long syscall(long number, ...) {
+    if (number == SYS_io_uring_setup) {
+        errno = ENOSYS;
+        return -1;
+    }
+    static long (*libc_syscall)(long, ...);
+    if (libc_syscall == NULL) {
+        libc_syscall = dlsym(RTLD_NEXT, "syscall");
+    }
+    va_list args;
+    va_start(args, number);
+    long a = va_arg(args, long);
+    long b = va_arg(args, long);
+    long c = va_arg(args, long);
+    long d = va_arg(args, long);
+    long e = va_arg(args, long);
+    long f = va_arg(args, long);
+    va_end(args);
+    return libc_syscall(number, a, b, c, d, e, f);
+}